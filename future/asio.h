@@ -0,0 +1,123 @@
+#ifndef FUTURE_DEMO_ASIO_H
+#define FUTURE_DEMO_ASIO_H
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/system/system_error.hpp>
+#include "future.h"
+
+namespace purecpp {
+// Lets Then(&ex, fn) and Async(&ex, fn) run on an io_context or a strand.
+// Tasks are dispatched, so a continuation fulfilled on the io thread (e.g.
+// by an operation started with use_future) runs right away without another
+// trip through the queue.
+template <typename Executor> class AsioExecutor {
+public:
+  explicit AsioExecutor(Executor ex) : ex_(std::move(ex)) {}
+
+  template <typename F> void execute(F &&f) {
+    boost::asio::dispatch(ex_, std::forward<F>(f));
+  }
+
+  const Executor &get_executor() const { return ex_; }
+
+private:
+  Executor ex_;
+};
+
+inline AsioExecutor<boost::asio::io_context::executor_type>
+MakeAsioExecutor(boost::asio::io_context &ctx) {
+  return AsioExecutor<boost::asio::io_context::executor_type>(
+      ctx.get_executor());
+}
+
+template <typename Executor>
+inline AsioExecutor<boost::asio::strand<Executor>>
+MakeAsioExecutor(const boost::asio::strand<Executor> &strand) {
+  return AsioExecutor<boost::asio::strand<Executor>>(strand);
+}
+
+// completion token turning an Asio operation into a Future, e.g.
+// Future<size_t> f = socket.async_read_some(buf, purecpp::use_future);
+// An error_code is reported as a boost::system::system_error.
+struct UseFuture {};
+constexpr UseFuture use_future{};
+
+namespace future_internal {
+template <typename... Args> struct AsioHandler;
+
+template <> struct AsioHandler<> {
+  using value_type = void;
+  explicit AsioHandler(UseFuture) {}
+
+  void operator()() { promise.SetValue(); }
+
+  Promise<void> promise;
+};
+
+template <> struct AsioHandler<boost::system::error_code> {
+  using value_type = void;
+  explicit AsioHandler(UseFuture) {}
+
+  void operator()(const boost::system::error_code &ec) {
+    if (ec) {
+      promise.SetException(
+          std::make_exception_ptr(boost::system::system_error(ec)));
+    } else {
+      promise.SetValue();
+    }
+  }
+
+  Promise<void> promise;
+};
+
+template <typename T> struct AsioHandler<boost::system::error_code, T> {
+  using value_type = T;
+  explicit AsioHandler(UseFuture) {}
+
+  template <typename U>
+  void operator()(const boost::system::error_code &ec, U &&value) {
+    if (ec) {
+      promise.SetException(
+          std::make_exception_ptr(boost::system::system_error(ec)));
+    } else {
+      promise.SetValue(std::forward<U>(value));
+    }
+  }
+
+  Promise<T> promise;
+};
+
+template <typename Handler> class AsioResult {
+public:
+  using completion_handler_type = Handler;
+  using return_type = Future<typename Handler::value_type>;
+
+  explicit AsioResult(completion_handler_type &handler)
+      : future_(handler.promise.GetFuture()) {}
+
+  return_type get() { return std::move(future_); }
+
+private:
+  return_type future_;
+};
+}
+}
+
+namespace boost {
+namespace asio {
+template <typename... Args>
+class async_result<purecpp::UseFuture, void(Args...)>
+    : public purecpp::future_internal::AsioResult<
+          purecpp::future_internal::AsioHandler<
+              typename std::decay<Args>::type...>> {
+public:
+  using purecpp::future_internal::AsioResult<
+      purecpp::future_internal::AsioHandler<
+          typename std::decay<Args>::type...>>::AsioResult;
+};
+}
+}
+#endif // FUTURE_DEMO_ASIO_H
@@ -0,0 +1,227 @@
+#ifndef FUTURE_DEMO_ASYNC_CACHE_H
+#define FUTURE_DEMO_ASYNC_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include "future.h"
+
+namespace purecpp {
+struct AsyncCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  // misses which joined a fetch already in flight instead of starting one.
+  uint64_t coalesced = 0;
+  uint64_t evictions = 0;
+};
+
+// Single-flight cache: concurrent misses of a key share one call of fetch,
+// which returns a Future<V>, and every caller gets its own future of the
+// result. Values are kept until they are older than ttl (zero keeps them
+// forever) or are the least recently used of their shard when it is full;
+// failed fetches are not cached. Keys are spread over shards, each with its
+// own lock, map and LRU list, so lookups of different keys rarely contend.
+// A hit still allocates the shared state of its ready future, TryGet reads
+// a value without one. The cache must outlive the fetches it started.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class AsyncCache {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit AsyncCache(size_t capacity,
+                      Clock::duration ttl = Clock::duration::zero(),
+                      size_t shards = 16)
+      : ttl_(ttl), shard_count_(shards ? shards : 1),
+        shards_(new Shard[shard_count_]) {
+    per_shard_ = (capacity + shard_count_ - 1) / shard_count_;
+    if (per_shard_ == 0) {
+      per_shard_ = 1;
+    }
+  }
+
+  AsyncCache(const AsyncCache &) = delete;
+  AsyncCache &operator=(const AsyncCache &) = delete;
+
+  template <typename F> Future<V> Get(const K &key, F &&fetch) {
+    auto &shard = ShardFor(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+      auto &entry = it->second;
+      if (entry.flight) {
+        shard.stats.coalesced++;
+        entry.flight->waiters.emplace_back();
+        return entry.flight->waiters.back().GetFuture();
+      }
+      if (!Expired(entry)) {
+        shard.stats.hits++;
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+        V value = *entry.value;
+        lock.unlock();
+        return MakeReadyFuture(std::move(value));
+      }
+      shard.lru.erase(entry.lru);
+      shard.map.erase(it);
+    }
+
+    shard.stats.misses++;
+    auto flight = std::make_shared<Flight>();
+    flight->waiters.emplace_back();
+    auto future = flight->waiters.back().GetFuture();
+    shard.map[key].flight = flight;
+    lock.unlock();
+
+    Future<V> fetched;
+    try {
+      fetched = fetch(key);
+    } catch (...) {
+      fetched = MakeExceptFuture<V>(std::current_exception());
+    }
+    fetched.Then(Lauch::Sync, [this, key, flight](Try<V> &&result) {
+      Complete(key, flight, std::move(result));
+    });
+    return future;
+  }
+
+  // copies a fresh cached value into value, never waits nor fetches.
+  bool TryGet(const K &key, V &value) {
+    auto &shard = ShardFor(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+    auto it = shard.map.find(key);
+    if (it == shard.map.end() || it->second.flight || Expired(it->second)) {
+      return false;
+    }
+
+    shard.stats.hits++;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+    value = *it->second.value;
+    return true;
+  }
+
+  // replaces the value, a fetch in flight for key still completes its
+  // waiters but is not stored.
+  void Put(const K &key, V value) {
+    auto &shard = ShardFor(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+    Erase(shard, key);
+    Store(shard, key, std::move(value));
+  }
+
+  void Erase(const K &key) {
+    auto &shard = ShardFor(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+    Erase(shard, key);
+  }
+
+  // cached values, fetches in flight not included.
+  size_t Size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < shard_count_; i++) {
+      std::unique_lock<std::mutex> lock(shards_[i].mtx);
+      size += shards_[i].lru.size();
+    }
+    return size;
+  }
+
+  AsyncCacheStats Stats() const {
+    AsyncCacheStats stats;
+    for (size_t i = 0; i < shard_count_; i++) {
+      std::unique_lock<std::mutex> lock(shards_[i].mtx);
+      auto &s = shards_[i].stats;
+      stats.hits += s.hits;
+      stats.misses += s.misses;
+      stats.coalesced += s.coalesced;
+      stats.evictions += s.evictions;
+    }
+    return stats;
+  }
+
+private:
+  // the callers waiting for one fetch.
+  struct Flight {
+    std::vector<Promise<V>> waiters;
+  };
+
+  // either a fetch in flight or a value in the LRU list.
+  struct Entry {
+    std::shared_ptr<Flight> flight;
+    absl::optional<V> value;
+    Clock::time_point expires;
+    typename std::list<K>::iterator lru;
+  };
+
+  struct Shard {
+    mutable std::mutex mtx;
+    std::unordered_map<K, Entry, Hash> map;
+    // most recently used first.
+    std::list<K> lru;
+    AsyncCacheStats stats;
+    // keeps the locks of neighbouring shards off one cache line.
+    char pad[64];
+  };
+
+  Shard &ShardFor(const K &key) {
+    // the low bits of std::hash are often the identity, mix them first.
+    uint64_t h = (uint64_t)Hash()(key) * 0x9E3779B97F4A7C15ull;
+    return shards_[(h >> 32) % shard_count_];
+  }
+
+  bool Expired(const Entry &entry) const {
+    return ttl_ != Clock::duration::zero() && Clock::now() >= entry.expires;
+  }
+
+  // called with the shard locked.
+  void Store(Shard &shard, const K &key, V value) {
+    auto &entry = shard.map[key];
+    entry.value = std::move(value);
+    entry.expires = Clock::now() + ttl_;
+    shard.lru.push_front(key);
+    entry.lru = shard.lru.begin();
+
+    while (shard.lru.size() > per_shard_) {
+      shard.map.erase(shard.lru.back());
+      shard.lru.pop_back();
+      shard.stats.evictions++;
+    }
+  }
+
+  // called with the shard locked.
+  void Erase(Shard &shard, const K &key) {
+    auto it = shard.map.find(key);
+    if (it == shard.map.end()) {
+      return;
+    }
+    if (!it->second.flight) {
+      shard.lru.erase(it->second.lru);
+    }
+    shard.map.erase(it);
+  }
+
+  void Complete(const K &key, const std::shared_ptr<Flight> &flight,
+                Try<V> &&result) {
+    auto &shard = ShardFor(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+    auto waiters = std::move(flight->waiters);
+    flight->waiters.clear();
+    auto it = shard.map.find(key);
+    bool current = it != shard.map.end() && it->second.flight == flight;
+    if (current) {
+      shard.map.erase(it);
+      if (!result.HasException()) {
+        Store(shard, key, result.Value());
+      }
+    }
+    lock.unlock();
+
+    const Try<V> &shared = result;
+    for (auto &promise : waiters) {
+      promise.SetValue(Try<V>(shared));
+    }
+  }
+
+  Clock::duration ttl_;
+  size_t shard_count_;
+  size_t per_shard_;
+  std::unique_ptr<Shard[]> shards_;
+};
+}
+#endif // FUTURE_DEMO_ASYNC_CACHE_H
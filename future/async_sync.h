@@ -0,0 +1,247 @@
+#ifndef FUTURE_DEMO_ASYNC_SYNC_H
+#define FUTURE_DEMO_ASYNC_SYNC_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "future.h"
+
+namespace purecpp {
+// Counting semaphore for Then chains: Acquire resolves once n permits are
+// taken instead of blocking a thread. An uncontended Acquire or Release is a
+// CAS on the permit count, the mutex is only taken when somebody has to park
+// or is parked. Parked acquirers are served in FIFO order and a new Acquire
+// does not overtake them, so a large request at the head holds back smaller
+// ones behind it. A granted Acquire's continuations run on the thread which
+// called Release. The semaphore must outlive its pending futures.
+class AsyncSemaphore {
+public:
+  explicit AsyncSemaphore(size_t permits) : permits_(permits) {}
+
+  AsyncSemaphore(const AsyncSemaphore &) = delete;
+  AsyncSemaphore &operator=(const AsyncSemaphore &) = delete;
+
+  size_t Available() const { return permits_.load(std::memory_order_acquire); }
+
+  // fails while acquirers are parked, even if there are enough permits.
+  bool TryAcquire(size_t n = 1) {
+    return waiters_.load() == 0 && TakePermits(n);
+  }
+
+  Future<void> Acquire(size_t n = 1) {
+    if (TryAcquire(n)) {
+      return MakeReadyFuture();
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (queue_.empty() && TakePermits(n)) {
+      waiters_.fetch_sub(1);
+      return MakeReadyFuture();
+    }
+
+    queue_.emplace_back(n, Promise<void>());
+    return queue_.back().second.GetFuture();
+  }
+
+  // pairs with the fence in Acquire, either it sees the permits or we see
+  // its registration.
+  void Release(size_t n = 1) {
+    permits_.fetch_add(n);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load() != 0) {
+      std::unique_lock<std::mutex> lock(mtx_);
+      Drain(lock);
+    }
+  }
+
+private:
+  bool TakePermits(size_t n) {
+    size_t permits = permits_.load(std::memory_order_relaxed);
+    while (permits >= n) {
+      if (permits_.compare_exchange_weak(permits, permits - n,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // called with mtx_ held, grants the head of the queue while the permits
+  // last and fulfils the grants after releasing the lock.
+  void Drain(std::unique_lock<std::mutex> &lock) {
+    std::vector<Promise<void>> granted;
+    while (!queue_.empty() && TakePermits(queue_.front().first)) {
+      granted.push_back(std::move(queue_.front().second));
+      queue_.pop_front();
+      waiters_.fetch_sub(1);
+    }
+    lock.unlock();
+
+    for (auto &promise : granted) {
+      promise.SetValue();
+    }
+  }
+
+  std::atomic<size_t> permits_;
+  std::atomic<size_t> waiters_{0};
+
+  std::mutex mtx_;
+  std::deque<std::pair<size_t, Promise<void>>> queue_;
+};
+
+// A mutex whose Lock resolves with a Guard owning it. Future values are
+// copied along a Then chain, so a Guard hands its ownership to every copy
+// made of it: the one in a Future's shared state gives it to the callback
+// taking the Guard, which releases the mutex when it returns, unless it
+// keeps a copy or calls Unlock first. FIFO and lock-free when uncontended,
+// like the AsyncSemaphore it is built on.
+class AsyncMutex {
+public:
+  class Guard {
+  public:
+    Guard() = default;
+
+    // copies take the ownership, the source is left empty.
+    Guard(const Guard &other) : mutex_(other.mutex_) { other.mutex_ = nullptr; }
+
+    Guard &operator=(const Guard &other) {
+      if (this != &other) {
+        Unlock();
+        mutex_ = other.mutex_;
+        other.mutex_ = nullptr;
+      }
+      return *this;
+    }
+
+    ~Guard() { Unlock(); }
+
+    bool OwnsLock() const { return mutex_ != nullptr; }
+
+    void Unlock() {
+      if (auto m = mutex_) {
+        mutex_ = nullptr;
+        m->Unlock();
+      }
+    }
+
+  private:
+    friend class AsyncMutex;
+
+    explicit Guard(AsyncMutex *mutex) : mutex_(mutex) {}
+
+    mutable AsyncMutex *mutex_ = nullptr;
+  };
+
+  AsyncMutex() : sem_(1) {}
+
+  AsyncMutex(const AsyncMutex &) = delete;
+  AsyncMutex &operator=(const AsyncMutex &) = delete;
+
+  Future<Guard> Lock() {
+    if (sem_.TryAcquire()) {
+      return MakeReadyFuture(Guard(this));
+    }
+    return sem_.Acquire().Then(Lauch::Sync, [this] { return Guard(this); });
+  }
+
+  // an empty Guard if the mutex is taken.
+  Guard TryLock() { return sem_.TryAcquire() ? Guard(this) : Guard(); }
+
+private:
+  void Unlock() { sem_.Release(); }
+
+  AsyncSemaphore sem_;
+};
+
+// Single use countdown: Wait resolves once CountDown brought the count to
+// zero, for every waiter. Counting down past zero is undefined.
+class AsyncLatch {
+public:
+  explicit AsyncLatch(size_t count) : count_(count), open_(count == 0) {}
+
+  AsyncLatch(const AsyncLatch &) = delete;
+  AsyncLatch &operator=(const AsyncLatch &) = delete;
+
+  void CountDown(size_t n = 1) {
+    if (count_.fetch_sub(n) != n) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    open_ = true;
+    auto waiters = std::move(waiters_);
+    waiters_.clear();
+    lock.unlock();
+
+    for (auto &promise : waiters) {
+      promise.SetValue();
+    }
+  }
+
+  bool TryWait() const { return count_.load(std::memory_order_acquire) == 0; }
+
+  Future<void> Wait() {
+    if (TryWait()) {
+      return MakeReadyFuture();
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (open_) {
+      return MakeReadyFuture();
+    }
+    waiters_.emplace_back();
+    return waiters_.back().GetFuture();
+  }
+
+  Future<void> ArriveAndWait(size_t n = 1) {
+    CountDown(n);
+    return Wait();
+  }
+
+private:
+  std::atomic<size_t> count_;
+
+  std::mutex mtx_;
+  bool open_;
+  std::vector<Promise<void>> waiters_;
+};
+
+// Reusable barrier for count parties: the futures of a phase resolve when
+// its last party arrives, on that party's thread. Every arrival registers a
+// waiter, so this one always takes the mutex.
+class AsyncBarrier {
+public:
+  explicit AsyncBarrier(size_t count) : count_(count ? count : 1) {}
+
+  AsyncBarrier(const AsyncBarrier &) = delete;
+  AsyncBarrier &operator=(const AsyncBarrier &) = delete;
+
+  Future<void> ArriveAndWait() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (waiters_.size() + 1 < count_) {
+      waiters_.emplace_back();
+      return waiters_.back().GetFuture();
+    }
+
+    auto waiters = std::move(waiters_);
+    waiters_.clear();
+    lock.unlock();
+
+    for (auto &promise : waiters) {
+      promise.SetValue();
+    }
+    return MakeReadyFuture();
+  }
+
+private:
+  size_t count_;
+
+  std::mutex mtx_;
+  std::vector<Promise<void>> waiters_;
+};
+}
+#endif // FUTURE_DEMO_ASYNC_SYNC_H
@@ -0,0 +1,190 @@
+#ifndef FUTURE_DEMO_BATCHER_H
+#define FUTURE_DEMO_BATCHER_H
+
+#include <unordered_map>
+#include "timer.h"
+
+namespace purecpp {
+// Collects the keys passed to Load into batches (DataLoader style) and makes
+// one call of the batch function per batch. A batch is issued once it holds
+// max_batch distinct keys or window after its first key, whichever comes
+// first; a key loaded twice in one batch is requested once. The batch
+// function gets the keys and returns a future of one Try per key in the same
+// order, so single keys can fail on their own; a failed batch or a result of
+// the wrong size fails every key of it. The batch function is called on the
+// thread whose Load filled the batch or in Flush; a batch whose window
+// passed is handed off by the timer thread to a new thread like Async, or
+// to ex which must outlive the Batcher. Pending keys are flushed on
+// destruction.
+template <typename K, typename V, typename Hash = std::hash<K>> class Batcher {
+public:
+  using BatchFn =
+      std::function<Future<std::vector<Try<V>>>(const std::vector<K> &)>;
+
+  template <typename Rep, typename Period>
+  Batcher(BatchFn fn, size_t max_batch,
+          const std::chrono::duration<Rep, Period> &window,
+          Timer &timer = Timer::Default())
+      : core_(std::make_shared<Core>(
+            std::move(fn), max_batch ? max_batch : 1,
+            std::chrono::duration_cast<Timer::Clock::duration>(window),
+            timer, [](std::function<void()> task) {
+              future_internal::Spawn((future_internal::NoExecutor *)nullptr,
+                                     std::move(task));
+            })) {}
+
+  template <typename Ex, typename Rep, typename Period,
+            typename = absl::enable_if_t<is_executor<Ex>::value>>
+  Batcher(Ex *ex, BatchFn fn, size_t max_batch,
+          const std::chrono::duration<Rep, Period> &window,
+          Timer &timer = Timer::Default())
+      : core_(std::make_shared<Core>(
+            std::move(fn), max_batch ? max_batch : 1,
+            std::chrono::duration_cast<Timer::Clock::duration>(window),
+            timer, [ex](std::function<void()> task) {
+              Execute(*ex, std::move(task));
+            })) {}
+
+  Batcher(const Batcher &) = delete;
+  Batcher &operator=(const Batcher &) = delete;
+
+  ~Batcher() { Flush(); }
+
+  Future<V> Load(const K &key) {
+    std::unique_lock<std::mutex> lock(core_->mtx);
+    auto &batch = core_->pending;
+    if (!batch) {
+      batch = std::make_shared<Batch>();
+      core_->Arm(lock);
+    }
+
+    auto it = batch->index.find(key);
+    size_t slot;
+    if (it == batch->index.end()) {
+      slot = batch->keys.size();
+      batch->index.emplace(key, slot);
+      batch->keys.push_back(key);
+      batch->waiters.emplace_back();
+    } else {
+      slot = it->second;
+    }
+    batch->waiters[slot].emplace_back();
+    auto future = batch->waiters[slot].back().GetFuture();
+
+    if (batch->keys.size() >= core_->max_batch) {
+      core_->Issue(lock);
+    }
+    return future;
+  }
+
+  // issues the pending batch now, if there is one.
+  void Flush() {
+    std::unique_lock<std::mutex> lock(core_->mtx);
+    core_->Issue(lock);
+  }
+
+private:
+  struct Batch {
+    std::vector<K> keys;
+    std::unordered_map<K, size_t, Hash> index;
+    // the promises of every Load, per key.
+    std::vector<std::vector<Promise<V>>> waiters;
+
+    void Fulfil(Try<std::vector<Try<V>>> &&result) {
+      std::exception_ptr e;
+      if (result.HasException()) {
+        e = result.Exception();
+      } else if (result.Value().size() != keys.size()) {
+        e = std::make_exception_ptr(
+            std::runtime_error("batch result size mismatch"));
+      }
+
+      for (size_t i = 0; i < keys.size(); i++) {
+        for (auto &promise : waiters[i]) {
+          if (e) {
+            promise.SetException(std::exception_ptr(e));
+          } else {
+            const Try<V> &value = result.Value()[i];
+            promise.SetValue(Try<V>(value));
+          }
+        }
+      }
+    }
+  };
+
+  // shared with the timer callback, which may run after the Batcher is gone.
+  struct Core : std::enable_shared_from_this<Core> {
+    Core(BatchFn f, size_t max, Timer::Clock::duration w, Timer &t,
+         std::function<void(std::function<void()>)> d)
+        : fn(std::move(f)), max_batch(max), window(w), timer(t),
+          dispatch(std::move(d)) {}
+
+    // called with mtx held for a new pending batch.
+    void Arm(std::unique_lock<std::mutex> &) {
+      std::weak_ptr<Core> weak = this->shared_from_this();
+      auto batch = pending;
+      timer_id = timer.Schedule(window, [weak, batch] {
+        auto self = weak.lock();
+        if (!self) {
+          return;
+        }
+        std::unique_lock<std::mutex> lock(self->mtx);
+        if (self->pending != batch) {
+          return;
+        }
+        self->Take(lock);
+        // a slow batch function would delay every other timer.
+        self->dispatch([self, batch] { self->Call(batch); });
+      });
+    }
+
+    // called with mtx held, takes the pending batch and calls fn with it
+    // after releasing the lock.
+    void Issue(std::unique_lock<std::mutex> &lock) {
+      auto batch = Take(lock);
+      if (batch) {
+        Call(batch);
+      }
+    }
+
+    // called with mtx held, which is released, disarms the pending batch.
+    std::shared_ptr<Batch> Take(std::unique_lock<std::mutex> &lock) {
+      auto batch = std::move(pending);
+      pending = nullptr;
+      uint64_t id = timer_id;
+      timer_id = 0;
+      lock.unlock();
+      if (batch) {
+        timer.Cancel(id);
+      }
+      return batch;
+    }
+
+    void Call(const std::shared_ptr<Batch> &batch) {
+      Future<std::vector<Try<V>>> result;
+      try {
+        result = fn(batch->keys);
+      } catch (...) {
+        result =
+            MakeExceptFuture<std::vector<Try<V>>>(std::current_exception());
+      }
+      result.Then(Lauch::Sync, [batch](Try<std::vector<Try<V>>> &&r) {
+        batch->Fulfil(std::move(r));
+      });
+    }
+
+    BatchFn fn;
+    size_t max_batch;
+    Timer::Clock::duration window;
+    Timer &timer;
+    std::function<void(std::function<void()>)> dispatch;
+
+    std::mutex mtx;
+    std::shared_ptr<Batch> pending;
+    uint64_t timer_id = 0;
+  };
+
+  std::shared_ptr<Core> core_;
+};
+}
+#endif // FUTURE_DEMO_BATCHER_H
@@ -0,0 +1,234 @@
+#ifndef FUTURE_DEMO_BOUNDED_EXECUTOR_H
+#define FUTURE_DEMO_BOUNDED_EXECUTOR_H
+
+#include <deque>
+#include <iterator>
+#include <stdexcept>
+#include "future.h"
+
+namespace purecpp {
+// Admission control in front of another executor: at most max_concurrency
+// tasks run on the inner executor at once and at most max_queue tasks wait
+// for a slot. Work beyond that is parked with a promise that is fulfilled
+// once the work has been admitted, so producers get backpressure instead of
+// an ever growing queue. The executor must outlive the work queued on it,
+// and max_concurrency must be at least one.
+template <typename E> class BoundedExecutor {
+public:
+  BoundedExecutor(const BoundedExecutor &) = delete;
+  BoundedExecutor &operator=(const BoundedExecutor &) = delete;
+
+  BoundedExecutor(E *ex, size_t max_concurrency, size_t max_queue)
+      : ex_(ex), max_concurrency_(max_concurrency), max_queue_(max_queue) {
+    if (max_concurrency == 0) {
+      throw std::invalid_argument("max_concurrency must be at least one");
+    }
+  }
+
+  // never rejects, so it can be used with Async(&ex, ...) and Then(&ex, ...);
+  // tasks over the limit are parked until capacity frees up.
+  void submit(std::function<void()> f) { SubmitAsync(std::move(f)); }
+
+  // admits the task if there is a free slot or queue space, otherwise the
+  // task is dropped and the returned future holds an exception.
+  Future<void> TrySubmit(std::function<void()> f) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (!HasCapacity()) {
+      return MakeExceptFuture<void>(std::runtime_error("executor overloaded"));
+    }
+
+    Admit(std::move(f), lock);
+    return MakeReadyFuture();
+  }
+
+  // the returned future is fulfilled once the task has been admitted, it is
+  // ready immediately if there is capacity.
+  Future<void> SubmitAsync(std::function<void()> f) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (HasCapacity()) {
+      Admit(std::move(f), lock);
+      return MakeReadyFuture();
+    }
+
+    Promise<void> promise;
+    auto future = promise.GetFuture();
+    parked_.emplace_back(std::move(f), std::move(promise));
+    return future;
+  }
+
+  size_t Running() const {
+    std::unique_lock<std::mutex> lock(mtx_);
+    return running_;
+  }
+
+  size_t Queued() const {
+    std::unique_lock<std::mutex> lock(mtx_);
+    return queue_.size();
+  }
+
+  size_t Parked() const {
+    std::unique_lock<std::mutex> lock(mtx_);
+    return parked_.size();
+  }
+
+private:
+  bool HasCapacity() const {
+    return parked_.empty() &&
+           (running_ < max_concurrency_ || queue_.size() < max_queue_);
+  }
+
+  // called with mtx_ held, returns with mtx_ released.
+  void Admit(std::function<void()> f, std::unique_lock<std::mutex> &lock) {
+    if (running_ < max_concurrency_) {
+      running_++;
+      lock.unlock();
+      Dispatch(std::move(f));
+    } else {
+      queue_.push_back(std::move(f));
+      lock.unlock();
+    }
+  }
+
+  void Dispatch(std::function<void()> f) {
+    auto task = MakeMoveWrapper(std::move(f));
+    Execute(*ex_, [this, task]() mutable {
+      struct Finisher {
+        ~Finisher() { self->OnFinish(); }
+        BoundedExecutor *self;
+      } finisher{this};
+      (*task)();
+    });
+  }
+
+  void OnFinish() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    std::function<void()> next;
+    if (!queue_.empty()) {
+      next = std::move(queue_.front());
+      queue_.pop_front();
+    } else {
+      running_--;
+    }
+
+    // one slot or one queue entry was freed, promote the oldest parked task.
+    Promise<void> admitted;
+    bool has_admitted = false;
+    if (!parked_.empty()) {
+      auto parked = std::move(parked_.front());
+      parked_.pop_front();
+      admitted = std::move(parked.second);
+      has_admitted = true;
+      if (!next && running_ < max_concurrency_) {
+        running_++;
+        next = std::move(parked.first);
+      } else {
+        queue_.push_back(std::move(parked.first));
+      }
+    }
+    lock.unlock();
+
+    if (next) {
+      Dispatch(std::move(next));
+    }
+    if (has_admitted) {
+      admitted.SetValue();
+    }
+  }
+
+  E *ex_;
+  const size_t max_concurrency_;
+  const size_t max_queue_;
+
+  mutable std::mutex mtx_;
+  size_t running_ = 0;
+  std::deque<std::function<void()>> queue_;
+  std::deque<std::pair<std::function<void()>, Promise<void>>> parked_;
+};
+
+namespace future_internal {
+template <typename E, typename Iterator, typename F>
+struct ForEachContext
+    : public std::enable_shared_from_this<ForEachContext<E, Iterator, F>> {
+  ForEachContext(E *ex, size_t max_in_flight, Iterator b, Iterator e, F f)
+      : bounded(ex, max_in_flight, 0), it(b), end(e), fn(std::move(f)) {}
+
+  // admits the next element; once admitted the following one is submitted, so
+  // at most max_in_flight elements are running and one more is parked.
+  void Next() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (it == end || exception) {
+      return;
+    }
+    auto cur = it++;
+    in_flight++;
+    lock.unlock();
+
+    auto self = this->shared_from_this();
+    bounded
+        .SubmitAsync([self, cur]() {
+          try {
+            self->fn(*cur);
+          } catch (...) {
+            std::unique_lock<std::mutex> lock(self->mtx);
+            if (!self->exception) {
+              self->exception = std::current_exception();
+            }
+          }
+          self->Done();
+        })
+        .Then(Lauch::Sync, [self](Try<void>) { self->Next(); });
+  }
+
+  void Done() {
+    std::unique_lock<std::mutex> lock(mtx);
+    in_flight--;
+    if (in_flight != 0 || (it != end && !exception)) {
+      return;
+    }
+    auto e = exception;
+    lock.unlock();
+
+    if (e) {
+      pm.SetException(std::move(e));
+    } else {
+      pm.SetValue();
+    }
+  }
+
+  BoundedExecutor<E> bounded;
+  Iterator it;
+  Iterator end;
+  F fn;
+  std::mutex mtx;
+  size_t in_flight = 0;
+  std::exception_ptr exception;
+  Promise<void> pm;
+};
+}
+
+// calls fn on every element of range on ex with at most max_in_flight calls
+// running at a time. The range must outlive the returned future, the first
+// exception stops further submissions and is reported once the running calls
+// have finished. A max_in_flight of zero fails the future.
+template <typename E, typename Range, typename F>
+Future<void> ForEachAsync(E *ex, Range &range, size_t max_in_flight, F &&fn) {
+  using Iterator = decltype(std::begin(range));
+  using Context =
+      future_internal::ForEachContext<E, Iterator, absl::decay_t<F>>;
+
+  if (max_in_flight == 0) {
+    return MakeExceptFuture<void>(
+        std::invalid_argument("max_in_flight must be at least one"));
+  }
+  if (std::begin(range) == std::end(range)) {
+    return MakeReadyFuture();
+  }
+
+  auto ctx = std::make_shared<Context>(ex, max_in_flight, std::begin(range),
+                                       std::end(range), std::forward<F>(fn));
+  auto future = ctx->pm.GetFuture();
+  ctx->Next();
+  return future;
+}
+}
+#endif // FUTURE_DEMO_BOUNDED_EXECUTOR_H
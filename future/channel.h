@@ -0,0 +1,277 @@
+#ifndef FUTURE_DEMO_CHANNEL_H
+#define FUTURE_DEMO_CHANNEL_H
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "future.h"
+
+namespace purecpp {
+// Bounded multi-producer multi-consumer channel. Push resolves once the value
+// is in the channel and Pop once a value is available, so Then based stages
+// get backpressure without blocking a thread.
+//
+// Values live in a lock-free ring (Vyukov's bounded queue), Push/Pop only
+// take the mutex when they have to park or when somebody else is parked.
+// The capacity is rounded up to a power of two, at least two. Continuations
+// of Pop/Push futures may capture the channel, it must outlive them.
+template <typename T> class Channel {
+public:
+  explicit Channel(size_t capacity) {
+    // with a single cell a full and an empty ring have the same sequence.
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  Channel(const Channel &) = delete;
+  Channel &operator=(const Channel &) = delete;
+
+  ~Channel() {
+    while (PopRing([](T &&) {})) {
+    }
+  }
+
+  size_t Capacity() const { return mask_ + 1; }
+
+  bool IsClosed() const { return closed_.load(std::memory_order_acquire); }
+
+  Future<void> Push(T value) {
+    if (TryPush(value)) {
+      return MakeReadyFuture();
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (IsClosed()) {
+      return MakeExceptFuture<void>(std::runtime_error("channel closed"));
+    }
+
+    waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (push_waiters_.empty() && PushRing(value)) {
+      waiters_.fetch_sub(1);
+      Drain(lock);
+      return MakeReadyFuture();
+    }
+
+    Promise<void> promise;
+    auto future = promise.GetFuture();
+    push_waiters_.emplace_back(std::move(value), std::move(promise));
+    return future;
+  }
+
+  // value is moved from only if the push succeeded.
+  bool TryPush(T &value) {
+    if (waiters_.load() != 0 || IsClosed() || !PushRing(value)) {
+      return false;
+    }
+
+    NotifyWaiters();
+    return true;
+  }
+
+  Future<T> Pop() {
+    Future<T> future;
+    if (PopRing([&future](T &&v) { future = MakeReadyFuture(std::move(v)); })) {
+      NotifyWaiters();
+      return future;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (PopRing([&future](T &&v) { future = MakeReadyFuture(std::move(v)); })) {
+      waiters_.fetch_sub(1);
+      Drain(lock);
+      return future;
+    }
+
+    if (IsClosed()) {
+      waiters_.fetch_sub(1);
+      return MakeExceptFuture<T>(std::runtime_error("channel closed"));
+    }
+
+    pop_waiters_.emplace_back();
+    return pop_waiters_.back().GetFuture();
+  }
+
+  bool TryPop(T &value) {
+    if (!PopRing([&value](T &&v) { value = std::move(v); })) {
+      return false;
+    }
+
+    NotifyWaiters();
+    return true;
+  }
+
+  // takes up to max_count values, waits only if the channel is empty.
+  Future<std::vector<T>> PopBatch(size_t max_count) {
+    std::vector<T> batch;
+    auto sink = [&batch](T &&v) { batch.push_back(std::move(v)); };
+    while (batch.size() < max_count && PopRing(sink)) {
+    }
+
+    if (!batch.empty()) {
+      NotifyWaiters();
+      return MakeReadyFuture(std::move(batch));
+    }
+
+    return Pop().Then(Lauch::Sync, [this, max_count](Try<T> &&t) {
+      std::vector<T> batch;
+      batch.push_back(std::move(t.Value()));
+      auto sink = [&batch](T &&v) { batch.push_back(std::move(v)); };
+      while (batch.size() < max_count && PopRing(sink)) {
+      }
+      NotifyWaiters();
+      return batch;
+    });
+  }
+
+  // pending and later pushes fail, pops still drain the buffered values and
+  // fail once the channel is empty.
+  void Close() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    closed_.store(true, std::memory_order_release);
+    auto push_waiters = std::move(push_waiters_);
+    auto pop_waiters = std::move(pop_waiters_);
+    push_waiters_.clear();
+    pop_waiters_.clear();
+    waiters_.fetch_sub(push_waiters.size() + pop_waiters.size());
+    lock.unlock();
+
+    for (auto &waiter : push_waiters) {
+      waiter.second.SetException(
+          std::make_exception_ptr(std::runtime_error("channel closed")));
+    }
+    for (auto &promise : pop_waiters) {
+      promise.SetException(
+          std::make_exception_ptr(std::runtime_error("channel closed")));
+    }
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+    T *Value() { return reinterpret_cast<T *>(&storage); }
+  };
+
+  bool PushRing(T &value) {
+    Cell *cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    new (cell->Value()) T(std::move(value));
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <typename Sink> bool PopRing(Sink &&sink) {
+    Cell *cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    sink(std::move(*cell->Value()));
+    cell->Value()->~T();
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // after a lock-free push/pop: a parked waiter may now be servable. Pairs
+  // with the fence in the slow paths, either they see our change to the ring
+  // or we see their registration.
+  void NotifyWaiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load() != 0) {
+      std::unique_lock<std::mutex> lock(mtx_);
+      Drain(lock);
+    }
+  }
+
+  // called with mtx_ held, matches parked waiters against the ring and
+  // fulfils them after releasing the lock.
+  void Drain(std::unique_lock<std::mutex> &lock) {
+    std::vector<std::pair<Promise<T>, Try<T>>> popped;
+    std::vector<Promise<void>> pushed;
+    bool progress = true;
+    while (progress) {
+      progress = false;
+      while (!pop_waiters_.empty() &&
+             PopRing([this, &popped](T &&v) {
+               popped.emplace_back(std::move(pop_waiters_.front()),
+                                   Try<T>(std::move(v)));
+             })) {
+        pop_waiters_.pop_front();
+        waiters_.fetch_sub(1);
+        progress = true;
+      }
+
+      while (!push_waiters_.empty() && PushRing(push_waiters_.front().first)) {
+        pushed.push_back(std::move(push_waiters_.front().second));
+        push_waiters_.pop_front();
+        waiters_.fetch_sub(1);
+        progress = true;
+      }
+    }
+    lock.unlock();
+
+    for (auto &p : popped) {
+      p.first.SetValue(std::move(p.second));
+    }
+    for (auto &p : pushed) {
+      p.SetValue();
+    }
+  }
+
+  // producers, consumers and the waiter count are kept on separate lines.
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  char pad0_[64];
+  std::atomic<size_t> enqueue_pos_{0};
+  char pad1_[64];
+  std::atomic<size_t> dequeue_pos_{0};
+  char pad2_[64];
+  std::atomic<size_t> waiters_{0};
+  std::atomic<bool> closed_{false};
+
+  std::mutex mtx_;
+  std::deque<Promise<T>> pop_waiters_;
+  std::deque<std::pair<T, Promise<void>>> push_waiters_;
+};
+}
+#endif // FUTURE_DEMO_CHANNEL_H
@@ -0,0 +1,229 @@
+#ifndef FUTURE_DEMO_FIBER_EXECUTOR_H
+#define FUTURE_DEMO_FIBER_EXECUTOR_H
+
+#include <deque>
+#include <map>
+#include <boost/context/fiber.hpp>
+#include <boost/context/protected_fixedsize_stack.hpp>
+#include "future.h"
+
+namespace purecpp {
+// Runs every task on its own small stack. A task blocking in Get, Wait,
+// WaitFor or WaitUntil of a Future only suspends its fiber; the thread picks
+// up other work and the fiber is resumed, possibly on another thread, once
+// the value is set or the wait times out. So legacy code calling Get deep
+// in a call stack can block thousands of times on a handful of threads.
+// Other blocking calls (mutexes, sleeps, io) still block the whole thread,
+// and thread_local variables must not be relied upon across a wait. Tasks
+// must not throw, an exception escaping one is dropped. The destructor
+// waits for all submitted tasks to finish.
+class FiberExecutor {
+public:
+  explicit FiberExecutor(size_t threads = 1, size_t stack_size = 64 * 1024)
+      : stack_size_(stack_size) {
+    for (size_t i = 0; i < (threads ? threads : 1); i++) {
+      threads_.emplace_back([this] { Run(); });
+    }
+  }
+
+  FiberExecutor(const FiberExecutor &) = delete;
+  FiberExecutor &operator=(const FiberExecutor &) = delete;
+
+  ~FiberExecutor() {
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    cond_var_.notify_all();
+    for (auto &t : threads_) {
+      t.join();
+    }
+  }
+
+  void submit(std::function<void()> f) {
+    auto fiber = new Fiber(this, std::move(f));
+    std::unique_lock<std::mutex> lock(mtx_);
+    live_++;
+    ready_.push_back(fiber);
+    lock.unlock();
+    cond_var_.notify_one();
+  }
+
+  // tasks submitted and not finished yet, including suspended ones.
+  size_t Live() const {
+    std::unique_lock<std::mutex> lock(mtx_);
+    return live_;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  class Fiber : public future_internal::Suspendable {
+  public:
+    Fiber(FiberExecutor *ex, std::function<void()> task)
+        : ex_(ex), task_(std::move(task)) {}
+
+    std::function<void()> Waker() override {
+      token_ = std::make_shared<std::atomic<bool>>(false);
+      auto token = token_;
+      auto ex = ex_;
+      auto self = this;
+      return [token, ex, self] {
+        if (!token->exchange(true)) {
+          ex->Schedule(self);
+        }
+      };
+    }
+
+    void Suspend(std::unique_lock<future_internal::StateMutex> &lock,
+                 const Clock::time_point *deadline) override {
+      held_ = lock.release();
+      has_deadline_ = deadline != nullptr;
+      if (deadline) {
+        deadline_ = *deadline;
+      }
+      caller_ = std::move(caller_).resume();
+      lock = std::unique_lock<future_internal::StateMutex>(*held_);
+      held_ = nullptr;
+    }
+
+    // runs the fiber on the calling thread until it finishes or suspends,
+    // true if it finished.
+    bool Resume() {
+      if (!started_) {
+        started_ = true;
+        ctx_ = boost::context::fiber(
+            std::allocator_arg,
+            boost::context::protected_fixedsize_stack(ex_->stack_size_),
+            [this](boost::context::fiber &&caller) {
+              caller_ = std::move(caller);
+              try {
+                task_();
+              } catch (const boost::context::detail::forced_unwind &) {
+                throw;
+              } catch (...) {
+                // it cannot unwind past the fiber, see the class comment.
+              }
+              task_ = nullptr;
+              done_ = true;
+              return std::move(caller_);
+            });
+      }
+
+      auto trampoline = future_internal::Trampoline::Current();
+      future_internal::Suspendable::Current() = this;
+      future_internal::Trampoline::Current() = &trampoline_;
+      ctx_ = std::move(ctx_).resume();
+      future_internal::Trampoline::Current() = trampoline;
+      future_internal::Suspendable::Current() = nullptr;
+      return done_;
+    }
+
+    // called once the fiber is switched out: from here on a wake up may
+    // resume it on another thread.
+    void Parked() {
+      if (has_deadline_) {
+        ex_->AddTimer(deadline_, this, token_);
+      }
+      held_->unlock();
+    }
+
+  private:
+    FiberExecutor *ex_;
+    std::function<void()> task_;
+    // a fiber may suspend inside a continuation, so its inline depth moves
+    // with it instead of staying with the thread.
+    future_internal::Trampoline trampoline_;
+    boost::context::fiber ctx_;
+    boost::context::fiber caller_;
+    std::shared_ptr<std::atomic<bool>> token_;
+    future_internal::StateMutex *held_ = nullptr;
+    Clock::time_point deadline_;
+    bool has_deadline_ = false;
+    bool started_ = false;
+    bool done_ = false;
+  };
+
+  struct SleepEntry {
+    Fiber *fiber;
+    std::shared_ptr<std::atomic<bool>> token;
+  };
+
+  void Schedule(Fiber *fiber) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    ready_.push_back(fiber);
+    lock.unlock();
+    cond_var_.notify_one();
+  }
+
+  void AddTimer(Clock::time_point deadline, Fiber *fiber,
+                std::shared_ptr<std::atomic<bool>> token) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    bool earliest = timers_.empty() || deadline < timers_.begin()->first;
+    timers_.emplace(deadline, SleepEntry{fiber, std::move(token)});
+    lock.unlock();
+    if (earliest) {
+      cond_var_.notify_one();
+    }
+  }
+
+  // called with mtx_ held, a timer whose fiber was already woken is dropped.
+  void FireTimers() {
+    auto now = Clock::now();
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+      auto &timer = timers_.begin()->second;
+      if (!timer.token->exchange(true)) {
+        ready_.push_back(timer.fiber);
+      }
+      timers_.erase(timers_.begin());
+    }
+  }
+
+  void Run() {
+    for (;;) {
+      Fiber *fiber = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        for (;;) {
+          FireTimers();
+          if (!ready_.empty()) {
+            fiber = ready_.front();
+            ready_.pop_front();
+            break;
+          }
+          if (stop_ && live_ == 0) {
+            return;
+          }
+          if (timers_.empty()) {
+            cond_var_.wait(lock);
+          } else {
+            cond_var_.wait_until(lock, timers_.begin()->first);
+          }
+        }
+      }
+
+      if (!fiber->Resume()) {
+        fiber->Parked();
+        continue;
+      }
+
+      delete fiber;
+      std::unique_lock<std::mutex> lock(mtx_);
+      if (--live_ == 0 && stop_) {
+        lock.unlock();
+        cond_var_.notify_all();
+      }
+    }
+  }
+
+  size_t stack_size_;
+  mutable std::mutex mtx_;
+  std::condition_variable cond_var_;
+  std::deque<Fiber *> ready_;
+  std::multimap<Clock::time_point, SleepEntry> timers_;
+  size_t live_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+}
+#endif // FUTURE_DEMO_FIBER_EXECUTOR_H
@@ -5,6 +5,8 @@
 #ifndef FUTURE_DEMO_FUTURE_H
 #define FUTURE_DEMO_FUTURE_H
 
+#include "absl/meta/type_traits.h"
+#include "absl/types/optional.h"
 #include "helper.h"
 #include "try.h"
 #include "shared_state.h"
@@ -14,10 +16,106 @@ namespace purecpp {
 
 enum class Lauch { Async, Sync, Callback };
 
+// An executor is any type with execute(f) or submit(f) taking the nullary
+// task by its own type, so it can store the task without erasing it. It may
+// also have bulk_execute(n, f), calling f(0) ... f(n - 1), and a
+// static constexpr bool is_inline, true when it runs a task right away on
+// the calling thread: a Then on an inline executor is then fused like a
+// Lauch::Sync one and never goes through execute.
+namespace future_internal {
+// the executor passed by the overloads without one.
+struct NoExecutor {};
+
+struct ProbeTask {
+  void operator()() {}
+};
+
+struct ProbeBulkTask {
+  void operator()(size_t) {}
+};
+
+template <typename Ex, typename = void> struct HasExecute : std::false_type {};
+template <typename Ex>
+struct HasExecute<Ex, absl::void_t<decltype(std::declval<Ex &>().execute(
+                          std::declval<ProbeTask>()))>> : std::true_type {};
+
+template <typename Ex, typename = void> struct HasSubmit : std::false_type {};
+template <typename Ex>
+struct HasSubmit<Ex, absl::void_t<decltype(std::declval<Ex &>().submit(
+                         std::declval<ProbeTask>()))>> : std::true_type {};
+
+template <typename Ex, typename = void>
+struct HasBulkExecute : std::false_type {};
+template <typename Ex>
+struct HasBulkExecute<Ex,
+                      absl::void_t<decltype(std::declval<Ex &>().bulk_execute(
+                          size_t(0), std::declval<ProbeBulkTask>()))>>
+    : std::true_type {};
+
+template <typename Ex, typename = void> struct IsInline : std::false_type {};
+template <typename Ex>
+struct IsInline<Ex, absl::void_t<decltype(Ex::is_inline)>>
+    : std::integral_constant<bool, Ex::is_inline> {};
+}
+
+template <typename Ex>
+struct is_executor
+    : std::integral_constant<bool, future_internal::HasExecute<Ex>::value ||
+                                       future_internal::HasSubmit<Ex>::value> {
+};
+
+template <typename Ex>
+struct is_inline_executor : future_internal::IsInline<Ex> {};
+
+namespace future_internal {
+// true if a continuation for policy on ex runs on the thread fulfilling its
+// future, known at compile time unless ex may be null.
+inline bool RunsInline(Lauch policy, NoExecutor *) {
+  return policy != Lauch::Async && policy != Lauch::Callback;
+}
+
+template <typename Ex> inline bool RunsInline(Lauch policy, Ex *ex) {
+  return ex ? is_inline_executor<Ex>::value
+            : RunsInline(policy, (NoExecutor *)nullptr);
+}
+}
+
+// hands task to ex, execute is preferred over submit.
+template <typename Ex, typename F>
+inline absl::enable_if_t<future_internal::HasExecute<Ex>::value>
+Execute(Ex &ex, F &&task) {
+  ex.execute(std::forward<F>(task));
+}
+
+template <typename Ex, typename F>
+inline absl::enable_if_t<!future_internal::HasExecute<Ex>::value &&
+                         future_internal::HasSubmit<Ex>::value>
+Execute(Ex &ex, F &&task) {
+  ex.submit(std::forward<F>(task));
+}
+
+// runs task(0) ... task(n - 1) on ex, one Execute per index unless ex has a
+// bulk_execute.
+template <typename Ex, typename F>
+inline absl::enable_if_t<future_internal::HasBulkExecute<Ex>::value>
+BulkExecute(Ex &ex, size_t n, F &&task) {
+  ex.bulk_execute(n, std::forward<F>(task));
+}
+
+template <typename Ex, typename F>
+inline absl::enable_if_t<!future_internal::HasBulkExecute<Ex>::value>
+BulkExecute(Ex &ex, size_t n, F &&task) {
+  auto shared = std::make_shared<absl::decay_t<F>>(std::forward<F>(task));
+  for (size_t i = 0; i < n; i++) {
+    Execute(ex, [shared, i] { (*shared)(i); });
+  }
+}
+
 struct EmptyExecutor {
   template <typename F> void submit(F &&) {}
 };
 
+// adapts a pool with a submit(f) template, such as boost::basic_thread_pool.
 template <typename E> struct ExecutorAdaptor {
   ExecutorAdaptor(const ExecutorAdaptor &) = delete;
   ExecutorAdaptor &operator=(const ExecutorAdaptor &) = delete;
@@ -25,11 +123,300 @@ template <typename E> struct ExecutorAdaptor {
   template <typename... Args>
   ExecutorAdaptor(Args &&... args) : ex(std::forward<Args>(args)...) {}
 
-  void submit(std::function<void()> f) { ex.submit(std::move(f)); }
+  template <typename F> void execute(F &&f) { ex.submit(std::forward<F>(f)); }
+
+  template <typename F> void submit(F &&f) { execute(std::forward<F>(f)); }
 
   E ex;
 };
 
+namespace future_internal {
+struct NoArg {};
+struct TryArg {};
+struct ValueArg {};
+
+// the shape of the first parameter of a Then callback.
+template <typename A>
+using arg_tag_t = absl::conditional_t<
+    std::is_void<A>::value, NoArg,
+    absl::conditional_t<IsTry<A>::value, TryArg, ValueArg>>;
+
+// overload ranks, PreferArg wins when both are viable.
+struct CopyArg {};
+struct PreferArg : CopyArg {};
+
+template <typename F, typename Arg>
+inline auto CallWith(F &fn, Arg &&, NoArg, PreferArg) -> decltype(fn()) {
+  return fn();
+}
+
+// the argument as it is: a Try we own is moved in, the shared one of a
+// state is passed by const reference.
+template <typename F, typename Arg>
+inline auto CallWith(F &fn, Arg &&arg, TryArg, PreferArg)
+    -> decltype(fn(std::forward<Arg>(arg))) {
+  return fn(std::forward<Arg>(arg));
+}
+
+// a callback taking Try<T>&& of a shared Try gets a copy.
+template <typename F, typename Arg>
+inline auto CallWith(F &fn, Arg &&arg, TryArg, CopyArg)
+    -> decltype(fn(absl::decay_t<Arg>(arg))) {
+  return fn(absl::decay_t<Arg>(arg));
+}
+
+template <typename F, typename Arg>
+inline auto CallWith(F &fn, Arg &&arg, ValueArg, PreferArg)
+    -> decltype(fn(std::forward<Arg>(arg).Value())) {
+  return fn(std::forward<Arg>(arg).Value());
+}
+
+// a callback taking T& of a shared value gets a copy it may modify.
+template <typename F, typename Arg,
+          typename V = absl::decay_t<decltype(std::declval<Arg>().Value())>>
+inline auto CallWith(F &fn, Arg &&arg, ValueArg, CopyArg)
+    -> decltype(fn(std::declval<V &>())) {
+  V value(arg.Value());
+  return fn(value);
+}
+
+template <typename R, typename F, typename Arg, typename Tag>
+inline try_type_t<R> InvokeImpl(F &fn, Arg &&arg, Tag tag,
+                                std::true_type /* R is void */) {
+  CallWith(fn, std::forward<Arg>(arg), tag, PreferArg{});
+  return try_type_t<R>();
+}
+
+template <typename R, typename F, typename Arg, typename Tag>
+inline try_type_t<R> InvokeImpl(F &fn, Arg &&arg, Tag tag,
+                                std::false_type /* R is not void */) {
+  return try_type_t<R>(CallWith(fn, std::forward<Arg>(arg), tag, PreferArg{}));
+}
+
+// calls fn with the shape its first parameter asks for (nothing, the Try
+// or the value) and wraps the result into a Try. The shape is resolved to
+// a tag once, so each Then instantiates a single invoker. arg is not
+// copied unless fn needs an rvalue of a shared (lvalue) Try.
+template <typename FirstArg, typename F, typename Arg>
+inline try_type_t<typename function_traits<F>::return_type> Invoke(F fn,
+                                                                   Arg &&arg) {
+  using R = typename function_traits<F>::return_type;
+  using Tag = arg_tag_t<FirstArg>;
+#if __cplusplus >= 201703L
+  if constexpr (std::is_void<R>::value) {
+    CallWith(fn, std::forward<Arg>(arg), Tag{}, PreferArg{});
+    return try_type_t<R>();
+  } else {
+    return try_type_t<R>(
+        CallWith(fn, std::forward<Arg>(arg), Tag{}, PreferArg{}));
+  }
+#else
+  return InvokeImpl<R>(fn, std::forward<Arg>(arg), Tag{}, std::is_void<R>{});
+#endif
+}
+
+// the value type of the future returned by Then(fn): a callback returning
+// Future<U> yields Future<U>, not Future<Future<U>>.
+template <typename F>
+using then_value_t =
+    typename IsFuture<typename function_traits<F>::return_type>::Inner;
+
+// records the delays of a continuation which is starting now, fulfilled is
+// null if it was registered after the value was set.
+inline void OnContinuationRun(const MetricsStamp &runnable,
+                              const MetricsStamp *fulfilled, bool submitted) {
+#ifdef FUTURE_ENABLE_METRICS
+  if (submitted) {
+    FUTURE_METRICS_RECORD(SubmitToRunNs, runnable.ElapsedNs());
+  }
+  if (fulfilled) {
+    FUTURE_METRICS_RECORD(FulfilToContinuationNs, fulfilled->ElapsedNs());
+  }
+#else
+  (void)runnable;
+  (void)fulfilled;
+  (void)submitted;
+#endif
+}
+
+// Sync continuations are fused: every Then(Lauch::Sync, fn) appends a stage
+// to the chain of its future instead of creating a promise, and the thread
+// which completes the source runs the stages back to back. A stage only
+// publishes its result through a promise when its future is observed (Get,
+// Wait, a non Sync Then, ...). The first stage and the states of observed
+// stages live in the allocation of the chain, so a single Sync Then costs
+// no more than a promise of its own.
+struct FusedStage {
+  virtual ~FusedStage() = default;
+  // computes the result, the parent stage has already run.
+  virtual void Run() = 0;
+  // fulfils the promise of the observed future, called once after Run.
+  virtual void Publish() = 0;
+
+  FusedStage *next = nullptr;
+  // allocated by Append, the others are members of the root.
+  bool owned = false;
+  bool ran = false;
+  bool publish = false;
+};
+
+template <typename T> struct FusedOutput : FusedStage {
+  void Publish() override {
+    if (children == 0) {
+      promise->SetValue(std::move(out));
+    } else {
+      const try_type_t<T> &value = *result;
+      promise->SetValue(try_type_t<T>(value));
+    }
+    // it shares the ownership of the chain, which must not keep itself.
+    promise.reset();
+  }
+
+  const try_type_t<T> *result = nullptr;
+  try_type_t<T> out;
+  size_t children = 0;
+  // the state of the observed future, built by Observe.
+  absl::optional<SharedState<T>> observed;
+  absl::optional<Promise<T>> promise;
+};
+
+template <typename T> struct FusedSource : FusedOutput<T> {
+  explicit FusedSource(std::shared_ptr<SharedState<T>> s)
+      : state(std::move(s)) {}
+
+  void Run() override { this->result = &state->value_; }
+
+  std::shared_ptr<SharedState<T>> state;
+};
+
+template <typename FirstArg, typename A, typename F>
+struct FusedThen : FusedOutput<typename function_traits<F>::return_type> {
+  using R = typename function_traits<F>::return_type;
+
+  FusedThen(FusedOutput<A> *p, F &&f) : parent(p), fn(std::move(f)) {}
+
+  void Run() override {
+    FUTURE_METRICS_ADD(ContinuationsInline);
+    try {
+      const try_type_t<A> &arg = *parent->result;
+      this->out = Invoke<FirstArg>(std::move(fn), arg);
+    } catch (...) {
+      this->out = try_type_t<R>(std::current_exception());
+    }
+    this->result = &this->out;
+  }
+
+  FusedOutput<A> *parent;
+  F fn;
+};
+
+class FusedChain : public std::enable_shared_from_this<FusedChain> {
+public:
+  explicit FusedChain(FusedStage *source)
+      : head_(source), tail_(source), cursor_(source) {}
+
+  void Append(std::unique_ptr<FusedStage> stage) {
+    stage->owned = true;
+    Link(stage.release());
+  }
+
+  // the source is done, runs every stage appended so far.
+  void Start() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    ready_ = true;
+    Pump(lock);
+  }
+
+  template <typename T> Future<T> Observe(FusedOutput<T> *stage) {
+    // the state is a member of the stage and shares the ownership of the
+    // chain, so observing does not allocate.
+    stage->observed.emplace();
+    Promise<T> promise(
+        std::shared_ptr<SharedState<T>>(shared_from_this(), &*stage->observed));
+    auto future = promise.GetFuture();
+    std::unique_lock<std::mutex> lock(mtx_);
+    stage->promise.emplace(std::move(promise));
+    if (!stage->ran) {
+      stage->publish = true;
+      return future;
+    }
+    lock.unlock();
+
+    stage->Publish();
+    return future;
+  }
+
+protected:
+  void Link(FusedStage *stage) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    tail_->next = stage;
+    tail_ = stage;
+    if (!cursor_) {
+      cursor_ = stage;
+    }
+    Pump(lock);
+  }
+
+  void DeleteAppended() {
+    for (FusedStage *stage = head_; stage;) {
+      FusedStage *next = stage->next;
+      if (stage->owned) {
+        delete stage;
+      }
+      stage = next;
+    }
+  }
+
+private:
+  // one thread at a time runs the stages, user code runs without the lock.
+  void Pump(std::unique_lock<std::mutex> &lock) {
+    while (ready_ && !running_ && cursor_) {
+      running_ = true;
+      FusedStage *stage = cursor_;
+      lock.unlock();
+      stage->Run();
+      lock.lock();
+      stage->ran = true;
+      cursor_ = stage->next;
+      running_ = false;
+
+      if (stage->publish) {
+        lock.unlock();
+        stage->Publish();
+        lock.lock();
+      }
+    }
+  }
+
+  std::mutex mtx_;
+  FusedStage *head_;
+  FusedStage *tail_;
+  FusedStage *cursor_;
+  bool ready_ = false;
+  bool running_ = false;
+};
+
+// the chain, its source and its first stage share one allocation.
+template <typename T, typename Stage> class FusedRoot : public FusedChain {
+public:
+  template <typename F>
+  FusedRoot(std::shared_ptr<SharedState<T>> state, F &&fn)
+      : FusedChain(&source_), source_(std::move(state)),
+        first_(&source_, std::forward<F>(fn)) {
+    source_.children++;
+    Link(&first_);
+  }
+
+  ~FusedRoot() { DeleteAppended(); }
+
+  Stage *First() { return &first_; }
+
+private:
+  FusedSource<T> source_;
+  Stage first_;
+};
+}
+
 template <typename T> class Future {
 public:
   using InnerType = T;
@@ -43,28 +430,32 @@ public:
   explicit Future(std::shared_ptr<SharedState<T>> state)
       : shared_state_(std::move(state)) {}
 
-  bool Valid() const { return shared_state_ != nullptr; }
+  bool Valid() const { return shared_state_ != nullptr || chain_ != nullptr; }
 
+  // a callback returning Future<U> is unwrapped: the result is a Future<U>
+  // which becomes ready with the future the callback returned.
   template <typename F>
-  Future<typename function_traits<F>::return_type> Then(F &&fn) {
+  Future<future_internal::then_value_t<F>> Then(F &&fn) {
     return Then(Lauch::Async, std::forward<F>(fn));
   }
 
   template <typename F>
-  Future<typename function_traits<F>::return_type>
-  Then(Lauch policy, F &&fn) {
-    return ThenImpl(policy, (EmptyExecutor *)nullptr, std::forward<F>(fn));
+  Future<future_internal::then_value_t<F>> Then(Lauch policy, F &&fn) {
+    return ThenImpl(policy, (future_internal::NoExecutor *)nullptr,
+                    std::forward<F>(fn));
   }
 
   template <typename F, typename Ex>
-  Future<typename function_traits<F>::return_type>
-  Then(Ex *executor, F &&fn) {
+  Future<future_internal::then_value_t<F>> Then(Ex *executor, F &&fn) {
+    static_assert(is_executor<Ex>::value,
+                  "an executor needs execute(f) or submit(f)");
     return ThenImpl(Lauch::Async, executor, std::forward<F>(fn));
   }
 
   T Get() {
+    Materialize();
     {
-      std::unique_lock<std::mutex> lock(shared_state_->then_mtx_);
+      auto lock = shared_state_->Lock();
       switch (shared_state_->state_) {
       case FutureStatus::None:
         break;
@@ -78,23 +469,28 @@ public:
       }
     }
     shared_state_->Wait();
-    std::unique_lock<std::mutex> lock(shared_state_->then_mtx_);
+    auto lock = shared_state_->Lock();
     return GetImpl<T>();
   }
 
   template <typename Rep, typename Period>
   FutureStatus
   WaitFor(const std::chrono::duration<Rep, Period> &timeout_duration) const {
+    Materialize();
     return shared_state_->WaitFor(timeout_duration);
   }
 
   template <typename Clock, typename Duration>
   FutureStatus WaitUntil(
       const std::chrono::time_point<Clock, Duration> &timeout_time) const {
+    Materialize();
     return shared_state_->WaitUntil(timeout_time);
   }
 
-  void Wait() { shared_state_->Wait(); }
+  void Wait() {
+    Materialize();
+    shared_state_->Wait();
+  }
 
   template <typename F>
   void Finally(F&& fn){
@@ -102,134 +498,178 @@ public:
   }
 
 private:
-  template <typename FirstArg, typename F, typename Executor, typename U>
-  void ExecuteTask(Lauch policy, Executor *executor, MoveWrapper<F> func,
-                          MoveWrapper<Promise<U>> next_prom,
-                          std::shared_ptr<SharedState<T>> const &state);
+  template <typename U> friend class Future;
+
+  Future(std::shared_ptr<future_internal::FusedChain> chain,
+         future_internal::FusedOutput<T> *stage)
+      : chain_(std::move(chain)), fused_(stage) {}
+
+  // a fused future gets a shared state once it is observed.
+  void Materialize() const {
+    if (chain_) {
+      shared_state_ = chain_->Observe(fused_).shared_state_;
+      chain_ = nullptr;
+      fused_ = nullptr;
+    }
+  }
 
-  template <typename F, typename Ex>
-  Future<typename function_traits<F>::return_type>
-  ThenImpl(Lauch policy, Ex *executor, F &&fn) {
-    static_assert(function_traits<F>::arity <= 1,
-                  "Then must take zero or one argument");
+  template <typename F>
+  Future<typename function_traits<F>::return_type> FuseThen(F &&fn) {
     using FirstArg = typename function_traits<F>::first_arg_t;
-    using return_type = typename function_traits<F>::return_type;
-    Promise<return_type> next_promise;
-    auto next_future = next_promise.GetFuture();
+    using Stage =
+        future_internal::FusedThen<FirstArg, T, absl::decay_t<F>>;
+
+    if (chain_) {
+      auto stage = new Stage(fused_, std::forward<F>(fn));
+      fused_->children++;
+      chain_->Append(std::unique_ptr<future_internal::FusedStage>(stage));
+      return Future<typename Stage::R>(chain_, stage);
+    }
 
-    auto func = MakeMoveWrapper(std::move(fn));
-    auto next_prom = MakeMoveWrapper(std::move(next_promise));
-    auto state = shared_state_;
+    auto root = std::make_shared<future_internal::FusedRoot<T, Stage>>(
+        shared_state_, std::forward<F>(fn));
+    Stage *stage = root->First();
+    std::shared_ptr<future_internal::FusedChain> chain = std::move(root);
 
-    std::unique_lock<std::mutex> lock(shared_state_->then_mtx_);
+    // subscribe after the first stage is in, a ready source runs it inline.
+    auto lock = shared_state_->Lock();
     if (shared_state_->state_ == FutureStatus::None) {
       shared_state_->continuations_.emplace_back(
-          [policy, executor, func, next_prom, state, this]() mutable {
-            ExecuteTask<FirstArg>(policy, executor, func, next_prom, state);
-          });
+          [chain]() { chain->Start(); });
     } else if (shared_state_->state_ == FutureStatus::Done) {
       lock.unlock();
-      ExecuteTask<FirstArg>(policy, executor, func, next_prom, shared_state_);
+      chain->Start();
     } else if (shared_state_->state_ == FutureStatus::Timeout) {
       throw std::runtime_error("timeout");
     }
 
-    return next_future;
+    return Future<typename Stage::R>(std::move(chain), stage);
   }
 
-  template <typename R> absl::enable_if_t<std::is_void<R>::value> GetImpl() {}
+  template <typename FirstArg, typename F, typename Executor, typename U>
+  void ExecuteTask(Lauch policy, Executor *executor, MoveWrapper<F> func,
+                          MoveWrapper<Promise<U>> next_prom,
+                          std::shared_ptr<SharedState<T>> const &state,
+                          bool queued);
 
-  template <typename R>
-  absl::enable_if_t<!std::is_void<R>::value, T> GetImpl() {
-    return std::move(shared_state_->value_.Value());
+  template <typename F, typename Ex>
+  Future<future_internal::then_value_t<F>>
+  ThenImpl(Lauch policy, Ex *executor, F &&fn) {
+    static_assert(function_traits<F>::arity <= 1,
+                  "Then must take zero or one argument");
+    return ThenImpl(
+        policy, executor, std::forward<F>(fn),
+        IsFuture<typename function_traits<F>::return_type>{});
   }
 
-  template <typename R, typename F, typename Arg>
-  static try_type_t<R> InvokeVoid(F fn, Arg , std::true_type/* R is same with void*/) {
-    fn();
-    return try_type_t<R>{};
+  template <typename F, typename Ex>
+  Future<future_internal::then_value_t<F>>
+  ThenImpl(Lauch policy, Ex *executor, F &&fn,
+           std::false_type /* returns a value */) {
+    if (future_internal::RunsInline(policy, executor)) {
+      return FuseThen(std::forward<F>(fn));
+    }
+    return Subscribe(policy, executor, std::forward<F>(fn));
   }
 
-  template <typename R, typename F, typename Arg>
-  static try_type_t<R> InvokeVoid(F fn, Arg , std::false_type/* R is not void type */) {
-      return try_type_t<R>(fn());
+  // not fused, the stage is a single link to the returned future.
+  template <typename F, typename Ex>
+  Future<future_internal::then_value_t<F>>
+  ThenImpl(Lauch policy, Ex *executor, F &&fn,
+           std::true_type /* returns a future */) {
+    return Subscribe(policy, executor, std::forward<F>(fn));
   }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) ->
-      typename std::enable_if<!IsTry<U>::value && std::is_same<void, U>::value,
-                              try_type_t<decltype(fn())>>::type {
-      using type = decltype(fn());
-      return InvokeVoid<type>(fn, arg, std::is_same<void, type>{});
+  // forwards the result into promise on the thread which sets it, the value
+  // is moved, this future is consumed.
+  void Forward(Promise<T> promise) {
+    Materialize();
+    auto state = shared_state_;
+    auto lock = state->Lock();
+    if (state->state_ == FutureStatus::None) {
+      auto p = MakeMoveWrapper(std::move(promise));
+      state->continuations_.emplace_back(
+          [state, p]() mutable { p->SetValue(std::move(state->value_)); });
+    } else if (state->state_ == FutureStatus::Done) {
+      state->state_ = FutureStatus::Retrived;
+      lock.unlock();
+      promise.SetValue(std::move(state->value_));
+    } else {
+      lock.unlock();
+      promise.SetException(std::make_exception_ptr(std::runtime_error(
+          state->state_ == FutureStatus::Timeout ? "timeout"
+                                                 : "already retrieved")));
+    }
   }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      !IsTry<U>::value && !std::is_same<void, U>::value &&
-          !std::is_void<typename function_traits<F>::return_type>::value,
-      try_type_t<decltype(fn(arg.Value()))>>::type {
-    using type = decltype(fn(arg.Value()));
-    return try_type_t<type>(fn(arg.Value()));
+  template <typename U>
+  static void Fulfil(Promise<U> &promise, try_type_t<U> &&result) {
+    promise.SetValue(std::move(result));
   }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      !IsTry<U>::value && !std::is_same<void, U>::value &&
-          std::is_void<typename function_traits<F>::return_type>::value,
-      try_type_t<decltype(fn(arg.Value()))>>::type {
-    using type = decltype(fn(arg.Value()));
-    fn(arg.Value());
-    return try_type_t<type>();
-  }
+  template <typename U>
+  static void Fulfil(Promise<U> &promise, Try<Future<U>> &&result) {
+    if (result.HasException()) {
+      promise.SetException(std::move(result.Exception()));
+      return;
+    }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      IsTry<U>::value && !std::is_same<void, typename IsTry<U>::Inner>::value &&
-          !std::is_void<typename function_traits<F>::return_type>::value,
-      try_type_t<decltype(fn(std::move(arg)))>>::type {
-    using type = decltype(fn(std::move(arg)));
-    return try_type_t<type>(fn(std::move(arg)));
+    auto inner = std::move(result.Value());
+    if (!inner.Valid()) {
+      promise.SetException(
+          std::make_exception_ptr(std::runtime_error("invalid future")));
+      return;
+    }
+    inner.Forward(std::move(promise));
   }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      IsTry<U>::value && !std::is_same<void, typename IsTry<U>::Inner>::value &&
-          std::is_void<typename function_traits<F>::return_type>::value,
-      try_type_t<decltype(fn(std::move(arg)))>>::type {
-    using type = decltype(fn(std::move(arg)));
-    fn(std::move(arg));
-    return try_type_t<type>();
-  }
+  template <typename F, typename Ex>
+  Future<future_internal::then_value_t<F>>
+  Subscribe(Lauch policy, Ex *executor, F &&fn) {
+    Materialize();
+    using FirstArg = typename function_traits<F>::first_arg_t;
+    using return_type = future_internal::then_value_t<F>;
+    Promise<return_type> next_promise;
+    auto next_future = next_promise.GetFuture();
+
+    auto func = MakeMoveWrapper(std::move(fn));
+    auto next_prom = MakeMoveWrapper(std::move(next_promise));
+    auto state = shared_state_;
+
+    auto lock = shared_state_->Lock();
+    if (shared_state_->state_ == FutureStatus::None) {
+      shared_state_->continuations_.emplace_back(
+          [policy, executor, func, next_prom, state, this]() mutable {
+            ExecuteTask<FirstArg>(policy, executor, func, next_prom, state,
+                                  true);
+          });
+    } else if (shared_state_->state_ == FutureStatus::Done) {
+      lock.unlock();
+      ExecuteTask<FirstArg>(policy, executor, func, next_prom, shared_state_,
+                            false);
+    } else if (shared_state_->state_ == FutureStatus::Timeout) {
+      throw std::runtime_error("timeout");
+    }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      IsTry<U>::value && std::is_same<void, typename IsTry<U>::Inner>::value &&
-          std::is_void<typename function_traits<F>::return_type>::value,
-      try_type_t<decltype(fn(std::move(arg)))>>::type {
-    using type = decltype(fn(std::move(arg)));
-    fn(std::move(arg));
-    return try_type_t<type>();
+    return next_future;
   }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      IsTry<U>::value && std::is_same<void, typename IsTry<U>::Inner>::value &&
-          !std::is_void<typename function_traits<F>::return_type>::value,
-      try_type_t<decltype(fn(std::move(arg)))>>::type {
-    using type = decltype(fn(std::move(arg)));
-    return try_type_t<type>(fn(std::move(arg)));
+  template <typename R> absl::enable_if_t<std::is_void<R>::value> GetImpl() {
+    if (shared_state_->value_.HasException()) {
+      std::rethrow_exception(shared_state_->value_.Exception());
+    }
   }
 
-  template <typename U, typename F, typename Arg>
-  static auto Invoke(F fn, Arg arg) -> typename std::enable_if<
-      IsFuture<U>::value &&
-          !std::is_same<void, typename IsFuture<U>::Inner>::value,
-      try_type_t<decltype(fn(std::move(arg)))>>::type {
-    using type = decltype(fn(std::move(arg)));
-    return try_type_t<type>(fn(std::move(arg)));
+  template <typename R>
+  absl::enable_if_t<!std::is_void<R>::value, T> GetImpl() {
+    return std::move(shared_state_->value_.Value());
   }
 
-  std::shared_ptr<SharedState<T>> shared_state_;
+  mutable std::shared_ptr<SharedState<T>> shared_state_;
+  // set instead of shared_state_ while the future is the result of a fused
+  // Sync stage which has not been observed yet.
+  mutable std::shared_ptr<future_internal::FusedChain> chain_;
+  mutable future_internal::FusedOutput<T> *fused_ = nullptr;
 };
 
 namespace future_internal {
@@ -246,6 +686,19 @@ inline absl::enable_if_t<!std::is_void<R>::value> SetValue(P &promise, F &&fn,
   promise.SetValue(absl::apply(fn, std::move(tp)));
 }
 
+template <typename F> inline void Spawn(NoExecutor *, F &&task) {
+  std::thread thd(std::forward<F>(task));
+  thd.detach();
+}
+
+template <typename Ex, typename F> inline void Spawn(Ex *ex, F &&task) {
+  if (ex) {
+    Execute(*ex, std::forward<F>(task));
+  } else {
+    Spawn((NoExecutor *)nullptr, std::forward<F>(task));
+  }
+}
+
 template <typename F, typename Ex, typename... Args>
 Future<typename function_traits<F>::return_type> inline AsyncImpl(
     Lauch policy, Ex *ex, F &&fn, Args &&... args) {
@@ -264,12 +717,7 @@ Future<typename function_traits<F>::return_type> inline AsyncImpl(
   };
 
   assert(policy != Lauch::Sync);
-  if (ex) {
-    ex->submit(std::move(task));
-  } else {
-    std::thread thd(std::move(task));
-    thd.detach();
-  }
+  Spawn(ex, std::move(task));
 
   return promise.GetFuture();
 }
@@ -280,12 +728,13 @@ template <typename F, typename... Args>
 inline Future<
     absl::result_of_t<typename std::decay<F>::type(absl::decay_t<Args>...)>>
 Async(F &&fn, Args &&... args) {
-  return future_internal::AsyncImpl(Lauch::Async, (EmptyExecutor *)nullptr,
-                                    std::forward<F>(fn),
-                                    std::forward<Args>(args)...);
+  return future_internal::AsyncImpl(
+      Lauch::Async, (future_internal::NoExecutor *)nullptr,
+      std::forward<F>(fn), std::forward<Args>(args)...);
 }
 
-template <typename F, typename Ex, typename... Args>
+template <typename F, typename Ex, typename... Args,
+          typename = absl::enable_if_t<is_executor<Ex>::value>>
 inline Future<
     absl::result_of_t<typename std::decay<F>::type(absl::decay_t<Args>...)>>
 Async(Ex *ex, F &&fn, Args &&... args) {
@@ -387,6 +836,162 @@ WhenAll(Iterator begin, Iterator end) {
   return ctx->pm.GetFuture();
 }
 
+// Folds the results with acc = op(std::move(acc), value) as they arrive
+// instead of collecting them, so only results not yet folded are held.
+// Results are folded in completion order, op should not depend on the
+// order. The first exception fails the returned future and the remaining
+// results are dropped.
+template <typename Iterator, typename T, typename Op>
+inline Future<T> WhenAllReduce(Iterator begin, Iterator end, T init, Op op) {
+  using value_t = future_value_t<iterator_value_t<Iterator>>;
+  using try_t = typename TryWrapper<value_t>::type;
+  static_assert(!std::is_void<value_t>::value,
+                "WhenAllReduce needs futures with a value");
+
+  if (begin == end) {
+    return MakeReadyFuture<T>(std::move(init));
+  }
+
+  struct Node {
+    explicit Node(try_t &&t) : value(std::move(t)) {}
+    try_t value;
+    Node *next = nullptr;
+  };
+
+  // a completing thread pushes its result on pending, then folds every
+  // pending result if no other thread is folding; a busy folder picks the
+  // result up before it lets go, so completions never block on each other.
+  struct ReduceContext {
+    ReduceContext(size_t n, T init, Op op)
+        : total(n), acc(std::move(init)), op(std::move(op)) {}
+
+    ~ReduceContext() {
+      for (Node *node = pending.load(); node;) {
+        Node *next = node->next;
+        delete node;
+        node = next;
+      }
+    }
+
+    void Arrive(Node *node) {
+      node->next = pending.load(std::memory_order_relaxed);
+      while (!pending.compare_exchange_weak(node->next, node,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+      }
+      // pairs with the fence after a folder lets go, either it sees our
+      // node or we see folding cleared.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      while (!folding.exchange(true, std::memory_order_acquire)) {
+        Node *list = pending.exchange(nullptr, std::memory_order_acquire);
+        while (list) {
+          std::unique_ptr<Node> cur(list);
+          list = list->next;
+          Fold(cur->value);
+          folded++;
+        }
+
+        bool done = folded == total;
+        if (done && !failed) {
+          pm.SetValue(std::move(acc));
+        }
+        folding.store(false, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (done || pending.load(std::memory_order_acquire) == nullptr) {
+          return;
+        }
+      }
+    }
+
+    void Fold(try_t &t) {
+      if (failed) {
+        return;
+      }
+      if (t.HasException()) {
+        failed = true;
+        pm.SetException(std::exception_ptr(t.Exception()));
+        return;
+      }
+      try {
+        acc = op(std::move(acc), std::move(t.Value()));
+      } catch (...) {
+        failed = true;
+        pm.SetException(std::current_exception());
+      }
+    }
+
+    Promise<T> pm;
+    std::atomic<Node *> pending{nullptr};
+    std::atomic<bool> folding{false};
+    // only touched by the folding thread.
+    size_t total;
+    size_t folded = 0;
+    bool failed = false;
+    T acc;
+    Op op;
+  };
+
+  auto ctx = std::make_shared<ReduceContext>(std::distance(begin, end),
+                                             std::move(init), std::move(op));
+  for (; begin != end; ++begin) {
+    begin->Then(Lauch::Sync,
+                [ctx](try_t &&t) { ctx->Arrive(new Node(std::move(t))); });
+  }
+
+  return ctx->pm.GetFuture();
+}
+
+// Assigns the i-th result to out[i] as it arrives, out must stay valid until
+// the returned future is ready. Unlike WhenAll the value type need not be
+// default constructible and no vector is allocated. The returned future
+// becomes ready once every result has arrived and carries the first
+// exception, if any; the slots of failed futures are left untouched.
+template <typename Iterator, typename OutIterator>
+inline Future<void> WhenAllInto(Iterator begin, Iterator end,
+                                OutIterator out) {
+  using value_t = future_value_t<iterator_value_t<Iterator>>;
+  using try_t = typename TryWrapper<value_t>::type;
+  static_assert(!std::is_void<value_t>::value,
+                "WhenAllInto needs futures with a value");
+
+  if (begin == end) {
+    return MakeReadyFuture();
+  }
+
+  struct IntoContext {
+    explicit IntoContext(size_t n) : remaining(n) {}
+    Promise<void> pm;
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed{false};
+    // written once by the thread which set failed.
+    std::exception_ptr exception;
+  };
+
+  auto ctx = std::make_shared<IntoContext>(std::distance(begin, end));
+  for (size_t i = 0; begin != end; ++begin, ++i) {
+    begin->Then(Lauch::Sync, [ctx, out, i](try_t &&t) {
+      if (t.HasException()) {
+        if (!ctx->failed.exchange(true)) {
+          ctx->exception = t.Exception();
+        }
+      } else {
+        out[i] = std::move(t.Value());
+      }
+
+      if (ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (ctx->exception) {
+          ctx->pm.SetException(std::move(ctx->exception));
+        } else {
+          ctx->pm.SetValue();
+        }
+      }
+    });
+  }
+
+  return ctx->pm.GetFuture();
+}
+
 namespace internal {
 template <typename... F>
 class WhenAllContext
@@ -486,26 +1091,10 @@ Future<std::pair<size_t, absl::variant<Try<typename absl::decay_t<F>::InnerType>
   return ctx->GetFuture();
 }
 
-template <typename T>
-template <typename FirstArg, typename F, typename Executor, typename U>
-void Future<T>::ExecuteTask(Lauch policy, Executor *executor,
-                            MoveWrapper<F> func,
-                            MoveWrapper<Promise<U>> next_prom,
-                            std::shared_ptr<SharedState<T>> const &state) {
-  auto task = [func, state, next_prom]() mutable {
-    try {
-      auto result = Invoke<FirstArg>(func.move(), state->value_);
-      next_prom->SetValue(std::move(result));
-    } catch (...) {
-      next_prom->SetException(std::current_exception());
-    }
-  };
-
-  if (executor) {
-    executor->submit(std::move(task));
-    return;
-  }
-
+namespace future_internal {
+// starts a type erased continuation for the Async and Callback policies, so
+// the thread launching code is instantiated once instead of once per Then.
+inline void LaunchTask(Lauch policy, std::function<void()> task) {
   if (policy == Lauch::Async) {
     Async(std::move(task));
   } else if(policy == Lauch::Callback){
@@ -517,12 +1106,61 @@ void Future<T>::ExecuteTask(Lauch policy, Executor *executor,
       f.WaitFor(std::chrono::minutes(60));//60 minutes is long enough
       f.Get();
     });
-  }else{
+  }
+}
+
+template <typename F>
+inline void Dispatch(Lauch policy, NoExecutor *, F &&task) {
+  if (RunsInline(policy, (NoExecutor *)nullptr)) {
     task();
+  } else {
+    LaunchTask(policy, std::forward<F>(task));
+  }
+}
+
+template <typename Ex, typename F>
+inline void Dispatch(Lauch policy, Ex *ex, F &&task) {
+  if (ex) {
+    Execute(*ex, std::forward<F>(task));
+  } else {
+    Dispatch(policy, (NoExecutor *)nullptr, std::forward<F>(task));
   }
 }
 }
 
+template <typename T>
+template <typename FirstArg, typename F, typename Executor, typename U>
+void Future<T>::ExecuteTask(Lauch policy, Executor *executor,
+                            MoveWrapper<F> func,
+                            MoveWrapper<Promise<U>> next_prom,
+                            std::shared_ptr<SharedState<T>> const &state,
+                            bool queued) {
+  bool submitted = !future_internal::RunsInline(policy, executor);
+  MetricsStamp runnable;
+  runnable.Set();
+  auto task = [func, state, next_prom, runnable, queued, submitted]() mutable {
+    future_internal::OnContinuationRun(
+        runnable, queued ? state->FulfilledAt() : nullptr, submitted);
+    try {
+      // other continuations and Get read it too.
+      const Try<T> &value = state->value_;
+      auto result = future_internal::Invoke<FirstArg>(func.move(), value);
+      Fulfil(*next_prom, std::move(result));
+    } catch (...) {
+      next_prom->SetException(std::current_exception());
+    }
+  };
+
+  if (submitted) {
+    FUTURE_METRICS_ADD(ContinuationsSubmitted);
+  } else {
+    FUTURE_METRICS_ADD(ContinuationsInline);
+  }
+
+  future_internal::Dispatch(policy, executor, std::move(task));
+}
+}
+
 
 
 #endif //FUTURE_DEMO_FUTURE_H
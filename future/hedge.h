@@ -0,0 +1,238 @@
+#ifndef FUTURE_DEMO_HEDGE_H
+#define FUTURE_DEMO_HEDGE_H
+
+#include <algorithm>
+#include "timer.h"
+
+namespace purecpp {
+// Keeps the latencies of the last window calls and derives a hedge delay
+// from them: the given percentile, or initial until min_samples were
+// recorded. With p95 only about one call in twenty is hedged. Delay is a
+// relaxed load, the percentile is recomputed every 16 records.
+class LatencyTracker {
+public:
+  using Clock = Timer::Clock;
+
+  explicit LatencyTracker(
+      double percentile = 0.95,
+      Clock::duration initial = std::chrono::milliseconds(10),
+      size_t window = 1024, size_t min_samples = 16)
+      : percentile_(percentile), window_(window ? window : 1),
+        min_samples_(min_samples), delay_ns_(ToNs(initial)) {}
+
+  void Record(Clock::duration latency) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (samples_.size() < window_) {
+      samples_.push_back(ToNs(latency));
+    } else {
+      samples_[next_] = ToNs(latency);
+    }
+    next_ = (next_ + 1) % window_;
+    if (samples_.size() < min_samples_ || ++since_update_ < 16) {
+      return;
+    }
+
+    since_update_ = 0;
+    sorted_ = samples_;
+    size_t rank = (size_t)(percentile_ * (sorted_.size() - 1));
+    std::nth_element(sorted_.begin(), sorted_.begin() + rank, sorted_.end());
+    delay_ns_.store(sorted_[rank], std::memory_order_relaxed);
+  }
+
+  Clock::duration Delay() const {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::nanoseconds(delay_ns_.load(std::memory_order_relaxed)));
+  }
+
+private:
+  static int64_t ToNs(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+  double percentile_;
+  size_t window_;
+  size_t min_samples_;
+  std::atomic<int64_t> delay_ns_;
+
+  std::mutex mtx_;
+  std::vector<int64_t> samples_;
+  std::vector<int64_t> sorted_;
+  size_t next_ = 0;
+  size_t since_update_ = 0;
+};
+
+namespace future_internal {
+template <typename T, typename F, typename Ex>
+struct HedgeContext
+    : public std::enable_shared_from_this<HedgeContext<T, F, Ex>> {
+  HedgeContext(F f, Timer::Clock::duration d, size_t max,
+               std::shared_ptr<LatencyTracker> t, Timer &tm, Ex *e)
+      : factory(std::move(f)), delay(d), max_attempts(max ? max : 1),
+        tracker(std::move(t)), timer(tm), ex(e) {}
+
+  // starts the next attempt and, if one is left, arms the hedge timer. A
+  // newer attempt or the result disarms it through the generation.
+  void Launch() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (done || started == max_attempts) {
+      return;
+    }
+    started++;
+    uint64_t gen = ++generation;
+    bool more = started < max_attempts;
+    uint64_t old_id = timer_id;
+    timer_id = 0;
+    lock.unlock();
+    if (old_id) {
+      timer.Cancel(old_id);
+    }
+
+    auto start = Timer::Clock::now();
+    Future<T> future;
+    try {
+      future = factory();
+    } catch (...) {
+      future = MakeExceptFuture<T>(std::current_exception());
+    }
+
+    auto self = this->shared_from_this();
+    future.Then(Lauch::Sync, [self, start](Try<T> &&t) {
+      self->OnResult(std::move(t), start);
+    });
+
+    if (!more) {
+      return;
+    }
+    // the timer thread only hands the hedge off, factory may take its time.
+    auto id = timer.Schedule(delay, [self, gen] {
+      std::unique_lock<std::mutex> lock(self->mtx);
+      if (!self->done && self->generation == gen) {
+        lock.unlock();
+        Spawn(self->ex, [self] { self->Launch(); });
+      }
+    });
+    lock.lock();
+    if (!done && generation == gen) {
+      timer_id = id;
+      return;
+    }
+    lock.unlock();
+    timer.Cancel(id);
+  }
+
+  // the first success wins, a failure starts the next attempt right away.
+  // Results arriving after the winner are dropped.
+  void OnResult(Try<T> &&t, Timer::Clock::time_point start) {
+    bool failed_attempt = t.HasException();
+    if (!failed_attempt && tracker) {
+      tracker->Record(Timer::Clock::now() - start);
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (done) {
+      return;
+    }
+    if (failed_attempt && ++failed < max_attempts) {
+      // otherwise the attempts still in flight decide.
+      bool next = started < max_attempts;
+      lock.unlock();
+      if (next) {
+        Launch();
+      }
+      return;
+    }
+
+    done = true;
+    uint64_t id = timer_id;
+    timer_id = 0;
+    lock.unlock();
+    if (id) {
+      timer.Cancel(id);
+    }
+    pm.SetValue(std::move(t));
+  }
+
+  F factory;
+  Timer::Clock::duration delay;
+  size_t max_attempts;
+  std::shared_ptr<LatencyTracker> tracker;
+  Timer &timer;
+  Ex *ex;
+  Promise<T> pm;
+
+  std::mutex mtx;
+  size_t started = 0;
+  size_t failed = 0;
+  uint64_t generation = 0;
+  uint64_t timer_id = 0;
+  bool done = false;
+};
+
+template <typename F>
+using hedge_value_t = future_value_t<typename function_traits<F>::return_type>;
+
+template <typename F, typename Ex>
+inline Future<hedge_value_t<F>>
+StartHedge(Ex *ex, F &&factory, Timer::Clock::duration delay,
+           size_t max_attempts, std::shared_ptr<LatencyTracker> tracker,
+           Timer &timer) {
+  using Ctx = HedgeContext<hedge_value_t<F>, absl::decay_t<F>, Ex>;
+  auto ctx = std::make_shared<Ctx>(std::forward<F>(factory), delay,
+                                   max_attempts, std::move(tracker), timer, ex);
+  auto future = ctx->pm.GetFuture();
+  ctx->Launch();
+  return future;
+}
+}
+
+// calls factory, and calls it again whenever delay passes without a result,
+// up to max_attempts calls. Resolves with the first success, or with the
+// last failure once every attempt failed; a failed attempt starts the next
+// one right away. The losing attempts are not cancelled, their results are
+// ignored. The first call is made on the calling thread, every hedge on a
+// new thread like Async.
+template <typename F, typename Rep, typename Period>
+inline Future<future_internal::hedge_value_t<F>>
+Hedge(F &&factory, const std::chrono::duration<Rep, Period> &delay,
+      size_t max_attempts, Timer &timer = Timer::Default()) {
+  return future_internal::StartHedge(
+      (future_internal::NoExecutor *)nullptr, std::forward<F>(factory),
+      std::chrono::duration_cast<Timer::Clock::duration>(delay), max_attempts,
+      nullptr, timer);
+}
+
+// as above with the hedges submitted to ex, which must outlive them.
+template <typename F, typename Ex, typename Rep, typename Period,
+          typename = absl::enable_if_t<is_executor<Ex>::value>>
+inline Future<future_internal::hedge_value_t<F>>
+Hedge(Ex *ex, F &&factory, const std::chrono::duration<Rep, Period> &delay,
+      size_t max_attempts, Timer &timer = Timer::Default()) {
+  return future_internal::StartHedge(
+      ex, std::forward<F>(factory),
+      std::chrono::duration_cast<Timer::Clock::duration>(delay), max_attempts,
+      nullptr, timer);
+}
+
+// as above with the delay taken from tracker, which records the latency of
+// every successful attempt, the hedged ones included.
+template <typename F>
+inline Future<future_internal::hedge_value_t<F>>
+Hedge(F &&factory, std::shared_ptr<LatencyTracker> tracker,
+      size_t max_attempts, Timer &timer = Timer::Default()) {
+  auto delay = tracker->Delay();
+  return future_internal::StartHedge((future_internal::NoExecutor *)nullptr,
+                                     std::forward<F>(factory), delay,
+                                     max_attempts, std::move(tracker), timer);
+}
+
+template <typename F, typename Ex,
+          typename = absl::enable_if_t<is_executor<Ex>::value>>
+inline Future<future_internal::hedge_value_t<F>>
+Hedge(Ex *ex, F &&factory, std::shared_ptr<LatencyTracker> tracker,
+      size_t max_attempts, Timer &timer = Timer::Default()) {
+  auto delay = tracker->Delay();
+  return future_internal::StartHedge(ex, std::forward<F>(factory), delay,
+                                     max_attempts, std::move(tracker), timer);
+}
+}
+#endif // FUTURE_DEMO_HEDGE_H
@@ -0,0 +1,282 @@
+#ifndef FUTURE_DEMO_METRICS_H
+#define FUTURE_DEMO_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace purecpp {
+// Counters and histograms of the futures runtime. The hooks in SharedState,
+// Promise and Future are only compiled in with FUTURE_ENABLE_METRICS defined,
+// otherwise they are empty and Metrics::Instance().Snapshot() stays zero.
+// The define changes the layout of SharedState, so it must be the same for
+// the whole program: set it with the CMake option of that name.
+enum class Counter {
+  FuturesCreated,
+  FuturesFulfilled,
+  // shared states destroyed without a value.
+  FuturesAbandoned,
+  ContinuationsInline,
+  ContinuationsSubmitted,
+  LockAcquired,
+  // then_mtx_ was held by another thread when we tried to take it.
+  LockContended,
+  kCount
+};
+
+enum class Histogram {
+  // from handing a continuation to an executor to it starting.
+  SubmitToRunNs,
+  // from SetValue to a continuation registered before it starting.
+  FulfilToContinuationNs,
+  ContinuationsPerFulfil,
+  // how long then_mtx_ was held, from taking it to releasing it.
+  LockHoldNs,
+  kCount
+};
+
+struct HistogramSnapshot {
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+  uint64_t p50 = 0;
+  uint64_t p90 = 0;
+  uint64_t p99 = 0;
+};
+
+struct MetricsSnapshot {
+  uint64_t counters[(size_t)Counter::kCount] = {};
+  HistogramSnapshot histograms[(size_t)Histogram::kCount];
+
+  uint64_t Get(Counter c) const { return counters[(size_t)c]; }
+  const HistogramSnapshot &Get(Histogram h) const {
+    return histograms[(size_t)h];
+  }
+
+  uint64_t Pending() const {
+    return Get(Counter::FuturesCreated) - Get(Counter::FuturesFulfilled) -
+           Get(Counter::FuturesAbandoned);
+  }
+
+  std::string ToText() const {
+    std::ostringstream os;
+    for (size_t i = 0; i < (size_t)Counter::kCount; i++) {
+      os << CounterName(i) << ' ' << counters[i] << '\n';
+    }
+    os << "futures_pending " << Pending() << '\n';
+    for (size_t i = 0; i < (size_t)Histogram::kCount; i++) {
+      auto &h = histograms[i];
+      os << HistogramName(i) << " count=" << h.count << " sum=" << h.sum
+         << " max=" << h.max << " p50=" << h.p50 << " p90=" << h.p90
+         << " p99=" << h.p99 << '\n';
+    }
+    return os.str();
+  }
+
+  std::string ToJson() const {
+    std::ostringstream os;
+    os << '{';
+    for (size_t i = 0; i < (size_t)Counter::kCount; i++) {
+      os << '"' << CounterName(i) << "\":" << counters[i] << ',';
+    }
+    os << "\"futures_pending\":" << Pending();
+    for (size_t i = 0; i < (size_t)Histogram::kCount; i++) {
+      auto &h = histograms[i];
+      os << ",\"" << HistogramName(i) << "\":{\"count\":" << h.count
+         << ",\"sum\":" << h.sum << ",\"max\":" << h.max
+         << ",\"p50\":" << h.p50 << ",\"p90\":" << h.p90
+         << ",\"p99\":" << h.p99 << '}';
+    }
+    os << '}';
+    return os.str();
+  }
+
+private:
+  static const char *CounterName(size_t i) {
+    static const char *names[] = {
+        "futures_created",         "futures_fulfilled",
+        "futures_abandoned",       "continuations_inline",
+        "continuations_submitted", "lock_acquired",
+        "lock_contended"};
+    return names[i];
+  }
+
+  static const char *HistogramName(size_t i) {
+    static const char *names[] = {"submit_to_run_ns",
+                                  "fulfil_to_continuation_ns",
+                                  "continuations_per_fulfil",
+                                  "lock_hold_ns"};
+    return names[i];
+  }
+};
+
+// Every thread updates one of kShards cache line aligned shards with relaxed
+// atomics, so recording does not bounce a shared line between cores. The
+// histograms are log-linear (HDR style): 8 linear sub-buckets per power of
+// two, which keeps the relative error of a quantile under 12.5%.
+class Metrics {
+public:
+  static Metrics &Instance() {
+    static Metrics metrics;
+    return metrics;
+  }
+
+  void Add(Counter c, uint64_t n = 1) {
+    Local().counters[(size_t)c].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  void Record(Histogram h, uint64_t value) {
+    auto &shard = Local();
+    auto &hist = shard.histograms[(size_t)h];
+    hist.buckets[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    hist.sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = hist.max.load(std::memory_order_relaxed);
+    while (value > max &&
+           !hist.max.compare_exchange_weak(max, value,
+                                           std::memory_order_relaxed)) {
+    }
+  }
+
+  // sums the shards, concurrent updates may or may not be included.
+  MetricsSnapshot Snapshot() const {
+    MetricsSnapshot snapshot;
+    for (size_t i = 0; i < (size_t)Counter::kCount; i++) {
+      for (auto &shard : shards_) {
+        snapshot.counters[i] +=
+            shard.counters[i].load(std::memory_order_relaxed);
+      }
+    }
+
+    for (size_t i = 0; i < (size_t)Histogram::kCount; i++) {
+      uint64_t buckets[kBuckets] = {};
+      auto &out = snapshot.histograms[i];
+      for (auto &shard : shards_) {
+        auto &hist = shard.histograms[i];
+        for (size_t b = 0; b < kBuckets; b++) {
+          buckets[b] += hist.buckets[b].load(std::memory_order_relaxed);
+        }
+        out.sum += hist.sum.load(std::memory_order_relaxed);
+        out.max = std::max(out.max, hist.max.load(std::memory_order_relaxed));
+      }
+
+      for (size_t b = 0; b < kBuckets; b++) {
+        out.count += buckets[b];
+      }
+      out.p50 = Quantile(buckets, out.count, 0.5, out.max);
+      out.p90 = Quantile(buckets, out.count, 0.9, out.max);
+      out.p99 = Quantile(buckets, out.count, 0.99, out.max);
+    }
+    return snapshot;
+  }
+
+  void Reset() {
+    for (auto &shard : shards_) {
+      for (auto &c : shard.counters) {
+        c.store(0, std::memory_order_relaxed);
+      }
+      for (auto &hist : shard.histograms) {
+        for (auto &b : hist.buckets) {
+          b.store(0, std::memory_order_relaxed);
+        }
+        hist.sum.store(0, std::memory_order_relaxed);
+        hist.max.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  static constexpr size_t kShards = 16;
+  static constexpr size_t kSubBits = 3;
+  static constexpr size_t kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+  struct HistogramShard {
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+  };
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> counters[(size_t)Counter::kCount];
+    HistogramShard histograms[(size_t)Histogram::kCount];
+  };
+
+  Metrics() { Reset(); }
+
+  Shard &Local() {
+    static std::atomic<size_t> next{0};
+    static thread_local size_t index = next.fetch_add(1) % kShards;
+    return shards_[index];
+  }
+
+  static size_t Bucket(uint64_t value) {
+    if (value < (1u << kSubBits)) {
+      return (size_t)value;
+    }
+    size_t exp = 0;
+    for (uint64_t v = value >> 1; v; v >>= 1) {
+      exp++;
+    }
+    size_t sub = (value >> (exp - kSubBits)) & ((1u << kSubBits) - 1);
+    return ((exp - kSubBits + 1) << kSubBits) + sub;
+  }
+
+  // the upper bound of a bucket, capped at the observed max.
+  static uint64_t Quantile(const uint64_t *buckets, uint64_t count, double q,
+                           uint64_t max) {
+    if (count == 0) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kBuckets; b++) {
+      seen += buckets[b];
+      if (seen >= rank) {
+        if (b < (1u << kSubBits)) {
+          return b;
+        }
+        size_t exp = (b >> kSubBits) + kSubBits - 1;
+        uint64_t sub = b & ((1u << kSubBits) - 1);
+        uint64_t upper = ((((uint64_t)1 << kSubBits) + sub + 1)
+                          << (exp - kSubBits)) - 1;
+        return std::min(upper, max);
+      }
+    }
+    return max;
+  }
+
+  Shard shards_[kShards];
+};
+
+// a point in time, empty unless metrics are compiled in.
+struct MetricsStamp {
+#ifdef FUTURE_ENABLE_METRICS
+  void Set() { at = std::chrono::steady_clock::now(); }
+
+  uint64_t ElapsedNs() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - at)
+        .count();
+  }
+
+  std::chrono::steady_clock::time_point at;
+#else
+  void Set() {}
+#endif
+};
+}
+
+#ifdef FUTURE_ENABLE_METRICS
+#define FUTURE_METRICS_ADD(counter)                                            \
+  ::purecpp::Metrics::Instance().Add(::purecpp::Counter::counter)
+#define FUTURE_METRICS_RECORD(histogram, value)                                \
+  ::purecpp::Metrics::Instance().Record(::purecpp::Histogram::histogram,       \
+                                        (value))
+#else
+#define FUTURE_METRICS_ADD(counter) (void)0
+#define FUTURE_METRICS_RECORD(histogram, value) (void)0
+#endif
+
+#endif // FUTURE_DEMO_METRICS_H
@@ -14,26 +14,29 @@ template <typename T> class Promise {
 public:
   Promise() : shared_state_(std::make_shared<SharedState<T>>()) {}
 
+  // fulfils a state which is part of a larger allocation.
+  explicit Promise(std::shared_ptr<SharedState<T>> state)
+      : shared_state_(std::move(state)) {}
+
   template <typename... Args> void SetValue(Args &&... val) {
     static_assert(sizeof...(Args) <= 1, "at most one argument");
-    std::unique_lock<std::mutex> lock(shared_state_->then_mtx_);
+    auto lock = shared_state_->Lock();
     if (shared_state_->state_ != FutureStatus::None) {
       return;
     }
 
     shared_state_->state_ = FutureStatus::Done;
     SetValueInternal(std::forward<Args...>(val)...);
-    shared_state_->cond_var_.notify_all();
+    shared_state_->NotifyWaiters();
 
     std::vector<std::function<void()>> continuations =
       std::move(shared_state_->continuations_);
+    shared_state_->StampFulfilled();
     lock.unlock();
+    FUTURE_METRICS_ADD(FuturesFulfilled);
+    FUTURE_METRICS_RECORD(ContinuationsPerFulfil, continuations.size());
 
-    for(auto const& continuation : continuations) {
-      if(continuation) {
-        continuation();
-      }
-    }
+    future_internal::Trampoline::Current()->Run(continuations);
   }
 
   void SetException(std::exception_ptr &&exp) { SetValue(std::move(exp)); }
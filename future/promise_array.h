@@ -0,0 +1,288 @@
+#ifndef FUTURE_DEMO_PROMISE_ARRAY_H
+#define FUTURE_DEMO_PROMISE_ARRAY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include "future.h"
+
+namespace purecpp {
+// N promises whose shared states live in one array, allocated together with
+// its control block, handed out futures keep the whole array alive.
+// SetValues fulfils a range at once: every state is published under its own
+// lock, waiters are woken once per parking slot and the continuations of the
+// range run in a single pass afterwards. WhenAll and WhenAny are tracked by a
+// counter in the array instead of a continuation per future. An element consumed with Get must not also be
+// read through WhenAll or WhenAny, Get moves the value out.
+template <typename T> class PromiseArray {
+  static_assert(!std::is_void<T>::value, "PromiseArray needs a value type");
+
+public:
+  explicit PromiseArray(size_t n) {
+    SharedState<T> *states = nullptr;
+    block_ = std::allocate_shared<Block>(TailAllocator<Block>(n, &states), n,
+                                         states);
+  }
+
+  size_t Size() const { return block_->size; }
+
+  Future<T> GetFuture(size_t i) {
+    auto &state = block_->states[i];
+    state.has_retrieved_ = true;
+    return Future<T>(std::shared_ptr<SharedState<T>>(block_, &state));
+  }
+
+  std::vector<Future<T>> GetFutures() {
+    std::vector<Future<T>> futures;
+    futures.reserve(Size());
+    for (size_t i = 0; i < Size(); i++) {
+      futures.push_back(GetFuture(i));
+    }
+    return futures;
+  }
+
+  template <typename V> void SetValue(size_t i, V &&value) {
+    Batch batch;
+    Store(batch, i, std::forward<V>(value));
+    Publish(batch);
+  }
+
+  void SetException(size_t i, std::exception_ptr e) {
+    Batch batch;
+    Store(batch, i, try_type_t<T>(std::move(e)));
+    Publish(batch);
+  }
+
+  // fulfils first, first + 1, ... with the values of [begin, end), elements
+  // which already have a value are skipped.
+  template <typename Iterator>
+  void SetValues(size_t first, Iterator begin, Iterator end) {
+    Batch batch;
+    for (size_t i = first; begin != end; ++begin, ++i) {
+      Store(batch, i, *begin);
+    }
+    Publish(batch);
+  }
+
+  // ready once every element is, with the values in index order or the
+  // exception of the lowest failed index.
+  Future<std::vector<T>> WhenAll() {
+    Promise<std::vector<T>> promise;
+    auto future = promise.GetFuture();
+    std::unique_lock<std::mutex> lock(block_->mtx);
+    block_->all.push_back(std::move(promise));
+    block_->watched = true;
+    lock.unlock();
+    Finish();
+    return future;
+  }
+
+  // ready with the element fulfilled first.
+  Future<std::pair<size_t, T>> WhenAny() {
+    Promise<std::pair<size_t, T>> promise;
+    auto future = promise.GetFuture();
+    std::unique_lock<std::mutex> lock(block_->mtx);
+    block_->any.push_back(std::move(promise));
+    block_->watched = true;
+    lock.unlock();
+    Finish();
+    return future;
+  }
+
+private:
+  static constexpr size_t kNone = std::numeric_limits<size_t>::max();
+
+  // the states are placed behind the control block allocate_shared gets
+  // from TailAllocator, the Block constructs and destroys them there.
+  struct Block {
+    Block(size_t n, SharedState<T> *&tail)
+        : states(tail), size(n), remaining(n) {
+      size_t i = 0;
+      try {
+        for (; i < n; i++) {
+          new (&states[i]) SharedState<T>();
+        }
+      } catch (...) {
+        Destroy(i);
+        throw;
+      }
+    }
+
+    ~Block() { Destroy(size); }
+
+    void Destroy(size_t n) {
+      while (n > 0) {
+        states[--n].~SharedState<T>();
+      }
+    }
+
+    SharedState<T> *states;
+    size_t size;
+    std::atomic<size_t> remaining;
+    std::atomic<size_t> first{kNone};
+    // set once WhenAll or WhenAny was asked for.
+    std::atomic<bool> watched{false};
+
+    // the WhenAll and WhenAny futures not completed yet.
+    std::mutex mtx;
+    std::vector<Promise<std::vector<T>>> all;
+    std::vector<Promise<std::pair<size_t, T>>> any;
+  };
+
+  // hands allocate_shared one buffer with room for n states after the
+  // control block, and reports where they go through tail.
+  template <typename U> struct TailAllocator {
+    using value_type = U;
+    template <typename V> struct rebind { using other = TailAllocator<V>; };
+
+    TailAllocator(size_t n, SharedState<T> **tail) : n(n), tail(tail) {}
+    template <typename V>
+    TailAllocator(const TailAllocator<V> &other) : n(other.n), tail(other.tail) {}
+
+    U *allocate(size_t count) {
+      static_assert(alignof(SharedState<T>) <= alignof(std::max_align_t),
+                    "states must fit the alignment of operator new");
+      char *p = static_cast<char *>(
+          ::operator new(Offset(count) + n * sizeof(SharedState<T>)));
+      *tail = reinterpret_cast<SharedState<T> *>(p + Offset(count));
+      return reinterpret_cast<U *>(p);
+    }
+
+    void deallocate(U *p, size_t) { ::operator delete(p); }
+
+    static size_t Offset(size_t count) {
+      size_t align = alignof(SharedState<T>);
+      return (count * sizeof(U) + align - 1) / align * align;
+    }
+
+    template <typename V> bool operator==(const TailAllocator<V> &other) const {
+      return n == other.n && tail == other.tail;
+    }
+    template <typename V> bool operator!=(const TailAllocator<V> &other) const {
+      return !(*this == other);
+    }
+
+    size_t n;
+    SharedState<T> **tail;
+  };
+
+  struct Batch {
+    std::vector<std::function<void()>> continuations;
+    std::vector<std::condition_variable_any *> wake;
+    size_t first = kNone;
+    size_t count = 0;
+  };
+
+  template <typename V> void Store(Batch &batch, size_t i, V &&value) {
+    auto &state = block_->states[i];
+    auto lock = state.Lock();
+    if (state.state_ != FutureStatus::None) {
+      // a future which timed out in WaitFor keeps reporting the timeout,
+      // WhenAll and WhenAny still count the element, with its value.
+      if (state.state_ == FutureStatus::Timeout && state.value_.NotInit()) {
+        state.value_ = std::forward<V>(value);
+        lock.unlock();
+        Count(batch, i);
+      }
+      return;
+    }
+
+    state.value_ = std::forward<V>(value);
+    state.state_ = FutureStatus::Done;
+    state.StampFulfilled();
+    if (state.has_waiters_) {
+      batch.wake.push_back(&future_internal::ParkingLot::For(&state));
+    }
+    FUTURE_METRICS_RECORD(ContinuationsPerFulfil, state.continuations_.size());
+    for (auto &continuation : state.continuations_) {
+      batch.continuations.push_back(std::move(continuation));
+    }
+    state.continuations_.clear();
+    lock.unlock();
+
+    FUTURE_METRICS_ADD(FuturesFulfilled);
+    Count(batch, i);
+  }
+
+  static void Count(Batch &batch, size_t i) {
+    if (batch.first == kNone) {
+      batch.first = i;
+    }
+    batch.count++;
+  }
+
+  void Publish(Batch &batch) {
+    if (batch.count == 0) {
+      return;
+    }
+
+    std::sort(batch.wake.begin(), batch.wake.end());
+    auto last = std::unique(batch.wake.begin(), batch.wake.end());
+    for (auto it = batch.wake.begin(); it != last; ++it) {
+      (*it)->notify_all();
+    }
+
+    size_t none = kNone;
+    bool first = block_->first.compare_exchange_strong(none, batch.first);
+    bool all = block_->remaining.fetch_sub(batch.count) == batch.count;
+    if ((first || all) && block_->watched) {
+      Finish();
+    }
+
+    future_internal::Trampoline::Current()->Run(batch.continuations);
+  }
+
+  // completes the requested aggregates which are ready.
+  void Finish() {
+    std::vector<Promise<std::vector<T>>> all;
+    std::vector<Promise<std::pair<size_t, T>>> any;
+    std::unique_lock<std::mutex> lock(block_->mtx);
+    size_t first = block_->first;
+    if (first != kNone) {
+      any.swap(block_->any);
+    }
+    if (block_->remaining == 0) {
+      all.swap(block_->all);
+    }
+    lock.unlock();
+
+    for (auto &promise : any) {
+      auto &state = block_->states[first];
+      auto state_lock = state.Lock();
+      if (state.value_.HasException()) {
+        auto e = state.value_.Exception();
+        state_lock.unlock();
+        promise.SetException(std::move(e));
+      } else {
+        auto value = std::make_pair(first, T(state.value_.Value()));
+        state_lock.unlock();
+        promise.SetValue(std::move(value));
+      }
+    }
+
+    for (auto &promise : all) {
+      std::vector<T> values;
+      values.reserve(block_->size);
+      std::exception_ptr e;
+      for (size_t i = 0; i < block_->size && !e; i++) {
+        auto &state = block_->states[i];
+        auto state_lock = state.Lock();
+        if (state.value_.HasException()) {
+          e = state.value_.Exception();
+        } else {
+          values.push_back(state.value_.Value());
+        }
+      }
+      if (e) {
+        promise.SetException(std::move(e));
+      } else {
+        promise.SetValue(std::move(values));
+      }
+    }
+  }
+
+  std::shared_ptr<Block> block_;
+};
+}
+#endif // FUTURE_DEMO_PROMISE_ARRAY_H
@@ -0,0 +1,480 @@
+#ifndef FUTURE_DEMO_REACTOR_H
+#define FUTURE_DEMO_REACTOR_H
+
+#ifdef __linux__
+#include <deque>
+#include <system_error>
+#include <unordered_map>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "future.h"
+
+namespace purecpp {
+// Completes futures from fd readiness on one epoll thread instead of
+// blocking a thread per operation. Every fd except regular files must be in
+// non-blocking mode. An operation is first tried on the calling thread, it
+// is only parked when it would block; operations on the same fd and
+// direction complete in submission order. Continuations of the returned
+// futures run on the reactor thread when the operation was parked, they
+// should hand longer work off to an executor.
+class Reactor {
+public:
+  Reactor() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+      throw std::system_error(errno, std::generic_category(), "reactor");
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  Reactor(const Reactor &) = delete;
+  Reactor &operator=(const Reactor &) = delete;
+
+  // parked operations fail with an exception.
+  ~Reactor() {
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    Wake();
+    thread_.join();
+
+    for (auto &entry : fds_) {
+      for (auto &ops : entry.second.ops) {
+        for (auto &op : ops) {
+          op->Fail(std::make_exception_ptr(
+              std::runtime_error("reactor stopped")));
+        }
+      }
+    }
+    close(wake_fd_);
+    close(epoll_fd_);
+  }
+
+  Future<void> WaitReadable(int fd) {
+    return Start<void>(fd, kRead, [fd] { return PollOnce(fd, POLLIN); });
+  }
+
+  Future<void> WaitWritable(int fd) {
+    return Start<void>(fd, kWrite, [fd] { return PollOnce(fd, POLLOUT); });
+  }
+
+  // reads up to len bytes, 0 means end of file. buf must stay valid until
+  // the future is ready.
+  Future<size_t> ReadAsync(int fd, void *buf, size_t len) {
+    return Start<size_t>(fd, kRead,
+                         [fd, buf, len] { return read(fd, buf, len); });
+  }
+
+  // writes up to len bytes, the result may be a partial write.
+  Future<size_t> WriteAsync(int fd, const void *buf, size_t len) {
+    return Start<size_t>(fd, kWrite,
+                         [fd, buf, len] { return write(fd, buf, len); });
+  }
+
+  // the accepted fd is non-blocking and close-on-exec.
+  Future<int> AcceptAsync(int fd) {
+    return Start<int>(fd, kRead, [fd]() -> ssize_t {
+      return accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    });
+  }
+
+  // fails the parked operations of fd, call it before closing fd.
+  void Cancel(int fd) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    auto it = fds_.find(fd);
+    if (it == fds_.end()) {
+      return;
+    }
+
+    std::deque<std::unique_ptr<Op>> ops[2];
+    ops[kRead] = std::move(it->second.ops[kRead]);
+    ops[kWrite] = std::move(it->second.ops[kWrite]);
+    fds_.erase(it);
+    // removed right away, so fd may be closed once Cancel returns.
+    Register(fd, 0);
+    lock.unlock();
+
+    for (auto &queue : ops) {
+      for (auto &op : queue) {
+        op->Fail(std::make_exception_ptr(
+            std::system_error(ECANCELED, std::generic_category())));
+      }
+    }
+  }
+
+private:
+  enum { kRead = 0, kWrite = 1 };
+
+  struct Op {
+    virtual ~Op() = default;
+    // tries the syscall, false if it would block.
+    virtual bool Attempt() = 0;
+    // fulfils the promise with the result of the last attempt.
+    virtual void Complete() = 0;
+    virtual void Fail(std::exception_ptr e) = 0;
+  };
+
+  template <typename T, typename F> struct OpImpl : Op {
+    explicit OpImpl(F f) : fn(std::move(f)) {}
+
+    bool Attempt() override {
+      do {
+        result = fn();
+      } while (result < 0 && errno == EINTR);
+      if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+      }
+      error = result < 0 ? errno : 0;
+      return true;
+    }
+
+    void Complete() override {
+      if (error) {
+        Fail(std::make_exception_ptr(
+            std::system_error(error, std::generic_category())));
+      } else {
+        SetResult(promise, result);
+      }
+    }
+
+    void Fail(std::exception_ptr e) override {
+      promise.SetException(std::move(e));
+    }
+
+    F fn;
+    ssize_t result = 0;
+    int error = 0;
+    Promise<T> promise;
+  };
+
+  struct FdState {
+    std::deque<std::unique_ptr<Op>> ops[2];
+    // the reactor thread holds the ops of the direction and tries them.
+    bool busy[2] = {false, false};
+    // tells a state which was cancelled and created again apart.
+    uint64_t epoch = 0;
+  };
+
+  // the ops of one ready direction, tried by the reactor thread without
+  // mtx_.
+  struct ReadyOps {
+    int fd;
+    int dir;
+    uint64_t epoch;
+    // a vector, which moves without throwing; tried from first on.
+    std::vector<std::unique_ptr<Op>> ops;
+    size_t first;
+  };
+
+  static ssize_t WouldBlock() {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  // 0 once fd is ready for events, -1 with errno set if it is not or poll
+  // failed.
+  static ssize_t PollOnce(int fd, short events) {
+    pollfd p{fd, events, 0};
+    int n = poll(&p, 1, 0);
+    if (n == 0) {
+      return WouldBlock();
+    }
+    if (n > 0 && (p.revents & POLLNVAL)) {
+      errno = EBADF;
+      return -1;
+    }
+    return n < 0 ? -1 : 0;
+  }
+
+  static void SetResult(Promise<void> &promise, ssize_t) {
+    promise.SetValue();
+  }
+
+  template <typename T>
+  static void SetResult(Promise<T> &promise, ssize_t result) {
+    promise.SetValue((T)result);
+  }
+
+  // the syscalls run without mtx_: an op is tried on the calling thread when
+  // nothing of its direction is queued, otherwise, or if it would block, it
+  // is queued and the reactor thread registers the fd.
+  template <typename T, typename F> Future<T> Start(int fd, int dir, F fn) {
+    auto op = new OpImpl<T, F>(std::move(fn));
+    std::unique_ptr<Op> holder(op);
+    auto future = op->promise.GetFuture();
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (FailIfStopped(lock, op)) {
+      return future;
+    }
+    auto it = fds_.find(fd);
+    bool first = it == fds_.end() ||
+                 (it->second.ops[dir].empty() && !it->second.busy[dir]);
+    lock.unlock();
+
+    if (first && op->Attempt()) {
+      op->Complete();
+      return future;
+    }
+
+    lock.lock();
+    if (FailIfStopped(lock, op)) {
+      return future;
+    }
+    auto entry = fds_.emplace(fd, FdState());
+    if (entry.second) {
+      entry.first->second.epoch = ++epochs_;
+    }
+    entry.first->second.ops[dir].push_back(std::move(holder));
+    bool wake = MarkDirty(fd);
+    lock.unlock();
+    if (wake) {
+      Wake();
+    }
+    return future;
+  }
+
+  // called with mtx_ held, unlocks it and fails op if the reactor is gone.
+  bool FailIfStopped(std::unique_lock<std::mutex> &lock, Op *op) {
+    if (!stop_ && !error_) {
+      return false;
+    }
+    int error = error_;
+    lock.unlock();
+    if (error) {
+      op->Fail(std::make_exception_ptr(
+          std::system_error(error, std::generic_category(), "epoll_wait")));
+    } else {
+      op->Fail(std::make_exception_ptr(std::runtime_error("reactor stopped")));
+    }
+    return true;
+  }
+
+  // called with mtx_ held, true if the reactor thread has to be woken.
+  bool MarkDirty(int fd) {
+    dirty_.push_back(fd);
+    return dirty_.size() == 1;
+  }
+
+  static uint32_t Interest(const FdState &state) {
+    return (state.ops[kRead].empty() ? 0 : (uint32_t)EPOLLIN) |
+           (state.ops[kWrite].empty() ? 0 : (uint32_t)EPOLLOUT);
+  }
+
+  // called with mtx_ held, syncs the epoll interest of fd with want; the
+  // errno of a failed registration. The only syscall made under mtx_: it
+  // orders the registration with Start and Cancel, so the number of a
+  // closed fd, once reused, never gets the interest of the old one.
+  int Register(int fd, uint32_t want) {
+    auto it = registered_.find(fd);
+    uint32_t have = it == registered_.end() ? 0 : it->second;
+    if (want == have) {
+      return 0;
+    }
+    if (want == 0) {
+      registered_.erase(it);
+      // fails if fd was already removed by closing it.
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+      return 0;
+    }
+
+    epoll_event ev{};
+    ev.events = want;
+    ev.data.fd = fd;
+    int op = have == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epoll_fd_, op, fd, &ev) < 0) {
+      // closing fd removes it behind our back.
+      int retry = errno == EEXIST ? EPOLL_CTL_MOD
+                                  : (errno == ENOENT ? EPOLL_CTL_ADD : -1);
+      if (retry < 0 || epoll_ctl(epoll_fd_, retry, fd, &ev) < 0) {
+        int error = errno;
+        registered_.erase(fd);
+        return error;
+      }
+    }
+    registered_[fd] = want;
+    return 0;
+  }
+
+  // fails the queued ops of fd with error, or of every fd if fd is -1.
+  void FailOps(int fd, int error, const char *what) {
+    std::vector<std::unique_ptr<Op>> failed;
+    std::unique_lock<std::mutex> lock(mtx_);
+    for (auto it = fds_.begin(); it != fds_.end();) {
+      if (fd >= 0 && it->first != fd) {
+        ++it;
+        continue;
+      }
+      for (auto &queue : it->second.ops) {
+        for (auto &op : queue) {
+          failed.push_back(std::move(op));
+        }
+      }
+      it = fds_.erase(it);
+    }
+    lock.unlock();
+
+    for (auto &op : failed) {
+      op->Fail(std::make_exception_ptr(
+          std::system_error(error, std::generic_category(), what)));
+    }
+  }
+
+  void Wake() {
+    uint64_t one = 1;
+    ssize_t r = write(wake_fd_, &one, sizeof(one));
+    (void)r;
+  }
+
+  void Run() {
+    epoll_event events[64];
+    std::vector<ReadyOps> ready;
+    std::vector<std::unique_ptr<Op>> done;
+    std::vector<std::unique_ptr<Op>> cancelled;
+    std::vector<int> dirty;
+    std::vector<std::pair<int, int>> failed;
+    for (;;) {
+      int n = epoll_wait(epoll_fd_, events, 64, -1);
+      if (n < 0 && errno != EINTR) {
+        // nothing would complete the parked ops anymore.
+        int error = errno;
+        {
+          std::unique_lock<std::mutex> lock(mtx_);
+          error_ = error;
+        }
+        FailOps(-1, error, "epoll_wait");
+        return;
+      }
+
+      // only collects the ready ops, they are tried without the lock.
+      bool woken = false;
+      std::unique_lock<std::mutex> lock(mtx_);
+      if (stop_) {
+        break;
+      }
+
+      dirty.swap(dirty_);
+      for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd_) {
+          woken = true;
+          continue;
+        }
+
+        // a stale registration is dropped as a dirty fd without state.
+        dirty.push_back(fd);
+        auto it = fds_.find(fd);
+        if (it == fds_.end()) {
+          continue;
+        }
+
+        // errors and hang ups are reported by the syscall of the op.
+        uint32_t ev = events[i].events;
+        uint32_t mask[2] = {EPOLLIN | EPOLLHUP | EPOLLERR,
+                            EPOLLOUT | EPOLLHUP | EPOLLERR};
+        FdState &state = it->second;
+        for (int dir = kRead; dir <= kWrite; dir++) {
+          auto &queue = state.ops[dir];
+          if ((ev & mask[dir]) && !queue.empty()) {
+            state.busy[dir] = true;
+            ready.push_back(ReadyOps{
+                fd, dir, state.epoch,
+                std::vector<std::unique_ptr<Op>>(
+                    std::make_move_iterator(queue.begin()),
+                    std::make_move_iterator(queue.end())),
+                0});
+            queue.clear();
+          }
+        }
+      }
+      lock.unlock();
+
+      if (woken) {
+        uint64_t count;
+        ssize_t r = read(wake_fd_, &count, sizeof(count));
+        (void)r;
+      }
+      for (auto &batch : ready) {
+        auto &ops = batch.ops;
+        while (batch.first < ops.size() && ops[batch.first]->Attempt()) {
+          done.push_back(std::move(ops[batch.first++]));
+        }
+      }
+
+      // the ops which would block go back in front of those queued since.
+      lock.lock();
+      for (auto &batch : ready) {
+        auto it = fds_.find(batch.fd);
+        auto rest = batch.ops.begin() + batch.first;
+        if (it == fds_.end() || it->second.epoch != batch.epoch) {
+          cancelled.insert(cancelled.end(), std::make_move_iterator(rest),
+                           std::make_move_iterator(batch.ops.end()));
+          continue;
+        }
+        auto &queue = it->second.ops[batch.dir];
+        queue.insert(queue.begin(), std::make_move_iterator(rest),
+                     std::make_move_iterator(batch.ops.end()));
+        it->second.busy[batch.dir] = false;
+      }
+      ready.clear();
+
+      for (int fd : dirty) {
+        auto it = fds_.find(fd);
+        uint32_t want = it == fds_.end() ? 0 : Interest(it->second);
+        if (want == 0 && it != fds_.end()) {
+          fds_.erase(it);
+        }
+        if (int error = Register(fd, want)) {
+          failed.emplace_back(fd, error);
+        }
+      }
+      dirty.clear();
+      lock.unlock();
+
+      for (auto &f : failed) {
+        FailOps(f.first, f.second, "epoll_ctl");
+      }
+      failed.clear();
+
+      for (auto &op : done) {
+        op->Complete();
+      }
+      done.clear();
+      // Cancel ran while they were being tried.
+      for (auto &op : cancelled) {
+        op->Fail(std::make_exception_ptr(
+            std::system_error(ECANCELED, std::generic_category())));
+      }
+      cancelled.clear();
+    }
+  }
+
+
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::mutex mtx_;
+  std::unordered_map<int, FdState> fds_;
+  // fds whose epoll interest may have to change.
+  std::vector<int> dirty_;
+  bool stop_ = false;
+  // the errno epoll_wait failed with.
+  int error_ = 0;
+  uint64_t epochs_ = 0;
+  // the interest registered with epoll.
+  std::unordered_map<int, uint32_t> registered_;
+  std::thread thread_;
+};
+}
+#endif // __linux__
+#endif // FUTURE_DEMO_REACTOR_H
@@ -0,0 +1,112 @@
+#ifndef FUTURE_DEMO_RETRY_H
+#define FUTURE_DEMO_RETRY_H
+
+#include <random>
+#include "timer.h"
+
+namespace purecpp {
+struct RetryPolicy {
+  // total number of calls to the factory, including the first one.
+  size_t max_attempts = 3;
+  std::chrono::milliseconds initial_backoff{10};
+  std::chrono::milliseconds max_backoff{1000};
+  double multiplier = 2.0;
+  // each backoff is scaled by a random factor in [1 - jitter, 1 + jitter].
+  double jitter = 0.2;
+  // decides whether a failed attempt is retried, empty retries everything.
+  std::function<bool(std::exception_ptr)> retry_if;
+
+  std::chrono::milliseconds Backoff(size_t attempt) const {
+    double backoff = (double)initial_backoff.count();
+    for (size_t i = 1; i < attempt && backoff < max_backoff.count(); i++) {
+      backoff *= multiplier;
+    }
+    backoff = std::min(backoff, (double)max_backoff.count());
+
+    if (jitter > 0) {
+      static thread_local std::mt19937 gen(std::random_device{}());
+      std::uniform_real_distribution<double> dist(1 - jitter, 1 + jitter);
+      backoff *= dist(gen);
+    }
+    return std::chrono::milliseconds((int64_t)std::max(backoff, 0.0));
+  }
+};
+
+namespace future_internal {
+template <typename T, typename F, typename Ex>
+struct RetryContext
+    : public std::enable_shared_from_this<RetryContext<T, F, Ex>> {
+  RetryContext(RetryPolicy p, F f, Ex *e)
+      : policy(std::move(p)), factory(std::move(f)), ex(e) {}
+
+  void Attempt() {
+    attempts++;
+    Future<T> future;
+    try {
+      future = factory();
+    } catch (...) {
+      future = MakeExceptFuture<T>(std::current_exception());
+    }
+
+    auto self = this->shared_from_this();
+    future.Then(Lauch::Sync,
+                [self](Try<T> &&t) { self->OnResult(std::move(t)); });
+  }
+
+  void OnResult(Try<T> &&t) {
+    if (t.HasException() && attempts < policy.max_attempts &&
+        (!policy.retry_if || policy.retry_if(t.Exception()))) {
+      // the pending retry only holds a timer entry, no thread. The timer
+      // thread only hands the attempt off, factory may take its time.
+      auto self = this->shared_from_this();
+      Timer::Default().Schedule(policy.Backoff(attempts), [self] {
+        Spawn(self->ex, [self] { self->Attempt(); });
+      });
+      return;
+    }
+
+    pm.SetValue(std::move(t));
+  }
+
+  RetryPolicy policy;
+  F factory;
+  Ex *ex;
+  size_t attempts = 0;
+  Promise<T> pm;
+};
+
+template <typename F, typename Ex>
+inline Future<future_value_t<typename function_traits<F>::return_type>>
+StartRetry(Ex *ex, RetryPolicy policy, F &&factory) {
+  using T = future_value_t<typename function_traits<F>::return_type>;
+  using Ctx = RetryContext<T, absl::decay_t<F>, Ex>;
+  auto ctx = std::make_shared<Ctx>(std::move(policy), std::forward<F>(factory),
+                                   ex);
+  auto future = ctx->pm.GetFuture();
+  ctx->Attempt();
+  return future;
+}
+}
+
+// calls factory until the returned future succeeds, the exception is rejected
+// by policy.retry_if or policy.max_attempts calls have been made; the result
+// of the last attempt is returned. The first call is made on the calling
+// thread, every retry on a new thread like Async.
+template <typename F>
+inline Future<future_value_t<typename function_traits<F>::return_type>>
+Retry(RetryPolicy policy, F &&factory) {
+  return future_internal::StartRetry((future_internal::NoExecutor *)nullptr,
+                                     std::move(policy),
+                                     std::forward<F>(factory));
+}
+
+// as above with the retries submitted to ex, which must outlive them.
+template <typename F, typename Ex,
+          typename = absl::enable_if_t<is_executor<Ex>::value>>
+inline Future<future_value_t<typename function_traits<F>::return_type>>
+Retry(Ex *ex, RetryPolicy policy, F &&factory) {
+  return future_internal::StartRetry(ex, std::move(policy),
+                                     std::forward<F>(factory));
+}
+}
+#endif // FUTURE_DEMO_RETRY_H
@@ -0,0 +1,98 @@
+#ifndef FUTURE_DEMO_SEMI_FUTURE_H
+#define FUTURE_DEMO_SEMI_FUTURE_H
+
+#include "future.h"
+
+namespace purecpp {
+namespace future_internal {
+template <typename T> inline T TakeValue(Try<T> &&t) {
+  return std::move(t.Value());
+}
+
+inline void TakeValue(Try<void> &&t) {
+  if (t.HasException()) {
+    std::rethrow_exception(t.Exception());
+  }
+}
+}
+
+// Lazy counterpart of Future: the work and every Then stage are only
+// recorded, nothing runs until the SemiFuture is attached to an executor
+// with Via or waited on with Get. All stages run back to back in a single
+// task, so the whole pipeline costs one dispatch, or none when Get runs it
+// inline on the calling thread.
+template <typename T> class SemiFuture {
+public:
+  using InnerType = T;
+  SemiFuture() = default;
+  SemiFuture(const SemiFuture &) = delete;
+  SemiFuture &operator=(const SemiFuture &) = delete;
+  SemiFuture(SemiFuture &&) = default;
+  SemiFuture &operator=(SemiFuture &&) = default;
+
+  explicit SemiFuture(std::function<try_type_t<T>()> work)
+      : work_(std::move(work)) {}
+
+  bool Valid() const { return work_ != nullptr; }
+
+  // records fn, it runs on the thread which runs the previous stage.
+  template <typename F>
+  SemiFuture<typename function_traits<F>::return_type> Then(F &&fn) {
+    static_assert(function_traits<F>::arity <= 1,
+                  "Then must take zero or one argument");
+    using FirstArg = typename function_traits<F>::first_arg_t;
+    using R = typename function_traits<F>::return_type;
+
+    auto work = MakeMoveWrapper(std::move(work_));
+    auto func = MakeMoveWrapper(absl::decay_t<F>(std::forward<F>(fn)));
+    return SemiFuture<R>([work, func]() mutable -> try_type_t<R> {
+      try_type_t<T> t = (*work)();
+      try {
+        return future_internal::Invoke<FirstArg>(func.move(), std::move(t));
+      } catch (...) {
+        return try_type_t<R>(std::current_exception());
+      }
+    });
+  }
+
+  // starts the recorded stages as one task on ex, consumes the SemiFuture.
+  template <typename Ex> Future<T> Via(Ex *ex) {
+    static_assert(is_executor<Ex>::value,
+                  "an executor needs execute(f) or submit(f)");
+    Promise<T> promise;
+    auto future = promise.GetFuture();
+    auto work = MakeMoveWrapper(std::move(work_));
+    Execute(*ex, [promise, work]() mutable { promise.SetValue((*work)()); });
+    return future;
+  }
+
+  // runs the recorded stages on the calling thread, consumes the SemiFuture.
+  T Get() {
+    auto work = std::move(work_);
+    return future_internal::TakeValue(work());
+  }
+
+private:
+  std::function<try_type_t<T>()> work_;
+};
+
+// lazy Async: records fn and args, see SemiFuture.
+template <typename F, typename... Args>
+inline SemiFuture<
+    absl::result_of_t<typename std::decay<F>::type(absl::decay_t<Args>...)>>
+Defer(F &&fn, Args &&... args) {
+  using R =
+      absl::result_of_t<typename std::decay<F>::type(absl::decay_t<Args>...)>;
+  auto func = MakeMoveWrapper(absl::decay_t<F>(std::forward<F>(fn)));
+  auto tp = MakeMoveWrapper(std::make_tuple(std::forward<Args>(args)...));
+  return SemiFuture<R>([func, tp]() mutable -> try_type_t<R> {
+    auto call = [&func, &tp]() -> R { return absl::apply(*func, tp.move()); };
+    try {
+      return future_internal::Invoke<void>(call, Try<void>());
+    } catch (...) {
+      return try_type_t<R>(std::current_exception());
+    }
+  });
+}
+}
+#endif // FUTURE_DEMO_SEMI_FUTURE_H
@@ -0,0 +1,144 @@
+#ifndef FUTURE_DEMO_SERIAL_EXECUTOR_H
+#define FUTURE_DEMO_SERIAL_EXECUTOR_H
+
+#include <atomic>
+#include "future.h"
+
+namespace purecpp {
+// A strand over another executor: tasks run one at a time in submission
+// order, so continuations scheduled with Then(&serial, ...) can share state
+// without a mutex. Submitting is a push onto a lock-free MPSC queue (Vyukov's
+// intrusive one); the submit finding the strand idle hands a single drain
+// task to the inner executor, which runs up to max_batch tasks back to back
+// on one thread and then resubmits itself if more are queued, so other work
+// on the inner executor is not starved. Tasks must not throw. The queue is
+// shared with the drain, so tasks still queued when the SerialExecutor is
+// destroyed run anyway; the inner executor must outlive them.
+template <typename E> class SerialExecutor {
+public:
+  SerialExecutor(const SerialExecutor &) = delete;
+  SerialExecutor &operator=(const SerialExecutor &) = delete;
+
+  explicit SerialExecutor(E *ex, size_t max_batch = 64)
+      : queue_(std::make_shared<Queue>(ex, max_batch ? max_batch : 1)) {}
+
+  template <typename F> void execute(F &&f) {
+    auto node = new TaskNode<absl::decay_t<F>>(std::forward<F>(f));
+    // counted before it is visible, so the drain never runs a task it
+    // doesn't know of.
+    bool idle = queue_->pending.fetch_add(1, std::memory_order_acq_rel) == 0;
+    queue_->Push(node);
+    if (idle) {
+      Queue::ScheduleDrain(queue_);
+    }
+  }
+
+  template <typename F> void submit(F &&f) { execute(std::forward<F>(f)); }
+
+private:
+  struct Node {
+    virtual ~Node() = default;
+    virtual void Run() {}
+
+    std::atomic<Node *> next{nullptr};
+  };
+
+  template <typename F> struct TaskNode : Node {
+    template <typename U> explicit TaskNode(U &&u) : f(std::forward<U>(u)) {}
+    void Run() override { f(); }
+
+    F f;
+  };
+
+  struct Queue {
+    Queue(E *e, size_t max) : ex(e), max_batch(max), head(&stub), tail(&stub) {}
+
+    ~Queue() {
+      while (auto node = Pop()) {
+        delete node;
+      }
+    }
+
+    // the drain holds the queue, it may run after the SerialExecutor is gone.
+    static void ScheduleDrain(const std::shared_ptr<Queue> &queue) {
+      Execute(*queue->ex, [queue] { queue->Drain(queue); });
+    }
+
+    // the only consumer: runs a batch and passes the strand on if tasks are
+    // left, pending counts the queued tasks plus the one running.
+    void Drain(const std::shared_ptr<Queue> &self) {
+      size_t ran = 0;
+      size_t spins = 0;
+      while (ran < max_batch) {
+        Node *node = Pop();
+        if (!node) {
+          // counted but not linked in yet, wait a little, then leave it to
+          // the next drain.
+          if (pending.load(std::memory_order_acquire) > ran && ++spins < 16) {
+            std::this_thread::yield();
+            continue;
+          }
+          break;
+        }
+        node->Run();
+        delete node;
+        ran++;
+      }
+
+      if (pending.fetch_sub(ran, std::memory_order_acq_rel) != ran) {
+        ScheduleDrain(self);
+      }
+    }
+
+    void Push(Node *node) {
+      node->next.store(nullptr, std::memory_order_relaxed);
+      Node *prev = head.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    // null if the queue is empty or a push is half done.
+    Node *Pop() {
+      Node *last = tail;
+      Node *next = last->next.load(std::memory_order_acquire);
+      if (last == &stub) {
+        if (!next) {
+          return nullptr;
+        }
+        tail = next;
+        last = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+
+      if (next) {
+        tail = next;
+        return last;
+      }
+
+      if (last != head.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+
+      Push(&stub);
+      next = last->next.load(std::memory_order_acquire);
+      if (next) {
+        tail = next;
+        return last;
+      }
+      return nullptr;
+    }
+
+    E *ex;
+    size_t max_batch;
+    Node stub;
+    // producers swap head, the drain owns tail; kept on separate lines.
+    char pad0[64];
+    std::atomic<Node *> head;
+    char pad1[64];
+    Node *tail;
+    std::atomic<size_t> pending{0};
+  };
+
+  std::shared_ptr<Queue> queue_;
+};
+}
+#endif // FUTURE_DEMO_SERIAL_EXECUTOR_H
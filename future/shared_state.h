@@ -4,34 +4,218 @@
 
 #ifndef FUTURE_DEMO_SHARED_STATE_H
 #define FUTURE_DEMO_SHARED_STATE_H
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <type_traits>
+#include <vector>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include "metrics.h"
 
 namespace purecpp {
-enum class FutureStatus { None, Timeout, Done, Retrived };
+enum class FutureStatus : uint8_t { None, Timeout, Done, Retrived };
+
+namespace future_internal {
+// Blocking waits are rare, so SharedState carries no condition variable of
+// its own: waiters park on one of a fixed set of condition variables picked
+// by the address of the state and recheck their state when woken.
+class ParkingLot {
+public:
+  static std::condition_variable_any &For(const void *state) {
+    static ParkingLot lot;
+    auto h = reinterpret_cast<uintptr_t>(state);
+    return lot.slots_[(h >> 6 ^ h >> 12) % kSlots].cond_var;
+  }
+
+private:
+  static constexpr size_t kSlots = 64;
+  struct alignas(64) Slot {
+    std::condition_variable_any cond_var;
+  };
+  Slot slots_[kSlots];
+};
+
+#ifdef FUTURE_ENABLE_METRICS
+// then_mtx_ with metrics compiled in: counts every acquisition and those
+// which found it held by another thread, and records how long it was held.
+class StateMutex {
+public:
+  void lock() {
+    FUTURE_METRICS_ADD(LockAcquired);
+    if (!mtx_.try_lock()) {
+      FUTURE_METRICS_ADD(LockContended);
+      mtx_.lock();
+    }
+    locked_at_.Set();
+  }
+
+  bool try_lock() {
+    if (!mtx_.try_lock()) {
+      return false;
+    }
+    FUTURE_METRICS_ADD(LockAcquired);
+    locked_at_.Set();
+    return true;
+  }
+
+  void unlock() {
+    auto held = locked_at_.ElapsedNs();
+    mtx_.unlock();
+    FUTURE_METRICS_RECORD(LockHoldNs, held);
+  }
+
+private:
+  std::mutex mtx_;
+  MetricsStamp locked_at_;
+};
+#else
+using StateMutex = std::mutex;
+#endif
+
+// Continuations started by SetValue run inline, which nests once per stage
+// of a chain. Past kMaxInlineDepth nested SetValue calls they are queued
+// instead and run by the outermost SetValue of the thread once its own
+// continuations have returned, so long chains cost no dispatch and a
+// bounded amount of stack.
+class Trampoline {
+public:
+  static constexpr size_t kMaxInlineDepth = 16;
+
+  // the trampoline of the running thread, fibers swap in their own.
+  static Trampoline *&Current() {
+    static thread_local Trampoline local;
+    static thread_local Trampoline *current = &local;
+    return current;
+  }
+
+  void Run(std::vector<std::function<void()>> &tasks) {
+    if (depth_ >= kMaxInlineDepth) {
+      for (auto &task : tasks) {
+        queue_.push_back(std::move(task));
+      }
+      return;
+    }
+
+    Enter enter(this);
+    for (auto &task : tasks) {
+      if (task) {
+        task();
+      }
+    }
+    if (depth_ == 1) {
+      Drain();
+    }
+  }
+
+  // called before blocking: a queued continuation may be the one the
+  // thread is about to wait for.
+  void RunPending() {
+    if (!queue_.empty()) {
+      Enter enter(this);
+      Drain();
+    }
+  }
+
+private:
+  struct Enter {
+    explicit Enter(Trampoline *t) : t(t) { t->depth_++; }
+    ~Enter() { t->depth_--; }
+    Trampoline *t;
+  };
+
+  void Drain() {
+    while (!queue_.empty()) {
+      auto task = std::move(queue_.front());
+      queue_.pop_front();
+      if (task) {
+        task();
+      }
+    }
+  }
+
+  size_t depth_ = 0;
+  std::deque<std::function<void()>> queue_;
+};
+
+// A task which can switch itself out instead of blocking its thread, see
+// FiberExecutor. Waits on a SharedState suspend the current one, if any.
+class Suspendable {
+public:
+  virtual ~Suspendable() = default;
+
+  // a callable making the task runnable again after the next Suspend, only
+  // the first wake up of one Suspend has an effect.
+  virtual std::function<void()> Waker() = 0;
+
+  // releases lock once the task is switched out and reacquires it when the
+  // task is woken or the deadline, if any, has passed.
+  virtual void
+  Suspend(std::unique_lock<StateMutex> &lock,
+          const std::chrono::steady_clock::time_point *deadline) = 0;
+
+  static Suspendable *&Current() {
+    static thread_local Suspendable *current = nullptr;
+    return current;
+  }
+};
+}
 
 template <typename T> struct SharedState {
   static_assert(std::is_same<T, void>::value ||
                 std::is_copy_constructible<T>() ||
                 std::is_move_constructible<T>(),
                 "must be copyable or movable or void");
-  SharedState() : state_(FutureStatus::None), has_retrieved_(false) {}
+  SharedState() : state_(FutureStatus::None), has_retrieved_(false) {
+    FUTURE_METRICS_ADD(FuturesCreated);
+  }
+
+  ~SharedState() {
+    if (state_ == FutureStatus::None || state_ == FutureStatus::Timeout) {
+      FUTURE_METRICS_ADD(FuturesAbandoned);
+    }
+  }
+
+  // takes then_mtx_, which counts contention and hold time when metrics are
+  // compiled in.
+  std::unique_lock<future_internal::StateMutex> Lock() {
+    return std::unique_lock<future_internal::StateMutex>(then_mtx_);
+  }
   using ValueType = typename TryWrapper<T>::type;
 
   void Wait() {
-    std::unique_lock<std::mutex> lock(then_mtx_);
-    cond_var_.wait(lock, [this]() { return state_ != FutureStatus::None; });
+    future_internal::Trampoline::Current()->RunPending();
+    auto lock = Lock();
+    if (auto task = future_internal::Suspendable::Current()) {
+      Suspend(task, lock, nullptr);
+      return;
+    }
+    has_waiters_ = true;
+    future_internal::ParkingLot::For(this).wait(
+        lock, [this]() { return state_ != FutureStatus::None; });
   }
 
   template <typename Rep, typename Period>
   FutureStatus
   WaitFor(const std::chrono::duration<Rep, Period> &timeout_duration)  {
-    std::unique_lock<std::mutex> lock(then_mtx_);
-    bool r = cond_var_.wait_for(lock, timeout_duration,
-                              [this]() { return state_ != FutureStatus::None; });
+    future_internal::Trampoline::Current()->RunPending();
+    auto lock = Lock();
+    bool r;
+    if (auto task = future_internal::Suspendable::Current()) {
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::duration_cast<
+                          std::chrono::steady_clock::duration>(timeout_duration);
+      r = Suspend(task, lock, &deadline);
+    } else {
+      has_waiters_ = true;
+      r = future_internal::ParkingLot::For(this).wait_for(
+          lock, timeout_duration,
+          [this]() { return state_ != FutureStatus::None; });
+    }
     if(!r){
       state_ = FutureStatus::Timeout;
     }
@@ -41,21 +225,77 @@ template <typename T> struct SharedState {
   template <typename Clock, typename Duration>
   FutureStatus WaitUntil(
       const std::chrono::time_point<Clock, Duration> &timeout_time)  {
-    std::unique_lock<std::mutex> lock(then_mtx_);
-    bool r = cond_var_.wait_until(lock, timeout_time,
-                                [this]() { return state_ != FutureStatus::None; });
+    future_internal::Trampoline::Current()->RunPending();
+    auto lock = Lock();
+    bool r;
+    if (auto task = future_internal::Suspendable::Current()) {
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::duration_cast<
+                          std::chrono::steady_clock::duration>(
+                          timeout_time - Clock::now());
+      r = Suspend(task, lock, &deadline);
+    } else {
+      has_waiters_ = true;
+      r = future_internal::ParkingLot::For(this).wait_until(
+          lock, timeout_time,
+          [this]() { return state_ != FutureStatus::None; });
+    }
     if(!r){
       state_ = FutureStatus::Timeout;
     }
     return state_;
   }
 
-  std::mutex then_mtx_;
-  std::condition_variable cond_var_;
-  Try<T> value_;
-  std::vector<std::function<void()>> continuations_;
+  // called with then_mtx_ held, switches task out until the state is ready
+  // or the deadline has passed; false on timeout.
+  bool Suspend(future_internal::Suspendable *task,
+               std::unique_lock<future_internal::StateMutex> &lock,
+               const std::chrono::steady_clock::time_point *deadline) {
+    while (state_ == FutureStatus::None) {
+      if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+        return false;
+      }
+      continuations_.push_back(task->Waker());
+      task->Suspend(lock, deadline);
+    }
+    return true;
+  }
+
+  // called with then_mtx_ held when the value is set.
+  void StampFulfilled() {
+#ifdef FUTURE_ENABLE_METRICS
+    fulfilled_at_.Set();
+#endif
+  }
+
+  // when the value was set, null without metrics.
+  const MetricsStamp *FulfilledAt() const {
+#ifdef FUTURE_ENABLE_METRICS
+    return &fulfilled_at_;
+#else
+    return nullptr;
+#endif
+  }
+
+  // called with then_mtx_ held after state_ left None.
+  void NotifyWaiters() {
+    if (has_waiters_) {
+      future_internal::ParkingLot::For(this).notify_all();
+    }
+  }
+
+  // then_mtx_ and the small fields it guards share the first cache line.
+  future_internal::StateMutex then_mtx_;
   FutureStatus state_;
   std::atomic<bool> has_retrieved_;
+  // some thread blocked in Wait, WaitFor or WaitUntil.
+  bool has_waiters_ = false;
+  Try<T> value_;
+  std::vector<std::function<void()>> continuations_;
+#ifdef FUTURE_ENABLE_METRICS
+  // only a member with metrics, even an empty one would cost 8 bytes.
+  MetricsStamp fulfilled_at_;
+#endif
 };
 }
 #endif // FUTURE_DEMO_SHARED_STATE_H
@@ -0,0 +1,283 @@
+#ifndef FUTURE_DEMO_SHM_FUTURE_H
+#define FUTURE_DEMO_SHM_FUTURE_H
+
+#ifdef __linux__
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "reactor.h"
+
+namespace purecpp {
+namespace future_internal {
+// One result in a named POSIX shared memory segment. state is the futex
+// word, it is waited on without FUTEX_PRIVATE so waiters in any process
+// mapping the segment are woken. Values are copied in and out bytewise.
+template <typename T> struct ShmBlock {
+  enum : uint32_t { kEmpty, kWriting, kValue, kError };
+
+  std::atomic<uint32_t> state;
+  std::atomic<uint32_t> waiters;
+  char error[256];
+  T value;
+};
+
+template <typename T> class ShmSlot {
+public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "shared memory futures need a trivially copyable T");
+  static_assert(ATOMIC_INT_LOCK_FREE == 2,
+                "the futex word must be a lock-free atomic");
+
+  using Block = ShmBlock<T>;
+
+  // creates the segment and an eventfd for it, or maps an existing segment
+  // and signals event_fd, which came from its creator, -1 for none.
+  ShmSlot(const std::string &name, bool create, int event_fd)
+      : name_(name), owner_(create), event_fd_(event_fd) {
+    int fd = shm_open(name.c_str(),
+                      create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), name);
+    }
+    if (create && ftruncate(fd, sizeof(Block)) != 0) {
+      int err = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::system_error(err, std::generic_category(), name);
+    }
+
+    void *addr = mmap(nullptr, sizeof(Block), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (addr == MAP_FAILED) {
+      if (create) {
+        shm_unlink(name.c_str());
+      }
+      throw std::system_error(err, std::generic_category(), name);
+    }
+    // a fresh segment is zero filled, which is kEmpty.
+    block_ = static_cast<Block *>(addr);
+
+    if (create) {
+      // not CLOEXEC, a child started with fork or exec inherits it.
+      event_fd_ = eventfd(0, EFD_NONBLOCK);
+      if (event_fd_ < 0) {
+        err = errno;
+        munmap(block_, sizeof(Block));
+        shm_unlink(name.c_str());
+        throw std::system_error(err, std::generic_category(), "eventfd");
+      }
+    }
+  }
+
+  ShmSlot(const ShmSlot &) = delete;
+  ShmSlot &operator=(const ShmSlot &) = delete;
+
+  // the creator removes the name, processes which mapped it keep the memory.
+  ~ShmSlot() {
+    munmap(block_, sizeof(Block));
+    if (owner_) {
+      shm_unlink(name_.c_str());
+      close(event_fd_);
+    }
+  }
+
+  int EventFd() const { return event_fd_; }
+
+  bool IsReady() const {
+    return block_->state.load(std::memory_order_acquire) >= Block::kValue;
+  }
+
+  // one-shot, false if a result was already set.
+  bool Set(const T *value, const std::string *error) {
+    uint32_t expected = Block::kEmpty;
+    if (!block_->state.compare_exchange_strong(expected, Block::kWriting,
+                                               std::memory_order_acquire)) {
+      return false;
+    }
+
+    if (value) {
+      std::memcpy(static_cast<void *>(&block_->value), value, sizeof(T));
+    } else {
+      size_t len = std::min(error->size(), sizeof(block_->error) - 1);
+      std::memcpy(block_->error, error->data(), len);
+      block_->error[len] = '\0';
+    }
+    block_->state.store(value ? Block::kValue : Block::kError,
+                        std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (block_->waiters.load() != 0) {
+      Futex(FUTEX_WAKE, INT_MAX, nullptr);
+    }
+    if (event_fd_ >= 0) {
+      uint64_t one = 1;
+      ssize_t n = write(event_fd_, &one, sizeof(one));
+      (void)n;
+    }
+    return true;
+  }
+
+  // false on timeout. deadline is an absolute CLOCK_MONOTONIC time, null
+  // waits forever.
+  bool Wait(const timespec *deadline) {
+    while (true) {
+      uint32_t state = block_->state.load(std::memory_order_acquire);
+      if (state >= Block::kValue) {
+        return true;
+      }
+
+      timespec left;
+      if (deadline) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t ns = (deadline->tv_sec - now.tv_sec) * 1000000000ll +
+                     (deadline->tv_nsec - now.tv_nsec);
+        if (ns <= 0) {
+          return false;
+        }
+        left.tv_sec = ns / 1000000000ll;
+        left.tv_nsec = ns % 1000000000ll;
+      }
+
+      // pairs with the fence in Set, either it sees us or we see the state.
+      block_->waiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (block_->state.load(std::memory_order_acquire) == state) {
+        Futex(FUTEX_WAIT, state, deadline ? &left : nullptr);
+      }
+      block_->waiters.fetch_sub(1);
+    }
+  }
+
+  // called once ready, throws the error set by the other process.
+  T Read() const {
+    if (block_->state.load(std::memory_order_acquire) == Block::kError) {
+      throw std::runtime_error(block_->error);
+    }
+    // T need not be default constructible.
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+    std::memcpy(&value, &block_->value, sizeof(T));
+    return *reinterpret_cast<T *>(&value);
+  }
+
+private:
+  long Futex(int op, uint32_t val, const timespec *timeout) {
+    return syscall(SYS_futex, &block_->state, op, val, timeout, nullptr, 0);
+  }
+
+  std::string name_;
+  bool owner_;
+  int event_fd_;
+  Block *block_ = nullptr;
+};
+}
+
+// Sets the result of a SharedMemoryFuture living in another process, for
+// trivially copyable T. Both ends name the same segment: one creates it,
+// the other opens it. The result is written into the segment, waiters
+// blocked in Get are woken through a process-shared futex, and the
+// creator's eventfd is signalled for futures bridged into a Reactor.
+template <typename T> class SharedMemoryPromise {
+public:
+  static SharedMemoryPromise Create(const std::string &name) {
+    return SharedMemoryPromise(
+        std::make_shared<future_internal::ShmSlot<T>>(name, true, -1));
+  }
+
+  // event_fd is the creator's EventFd(), inherited or passed over a unix
+  // socket; without it only Get on the other side notices the result.
+  static SharedMemoryPromise Open(const std::string &name, int event_fd = -1) {
+    return SharedMemoryPromise(
+        std::make_shared<future_internal::ShmSlot<T>>(name, false, event_fd));
+  }
+
+  int EventFd() const { return slot_->EventFd(); }
+
+  // false if a result was already set, by either process.
+  bool SetValue(const T &value) { return slot_->Set(&value, nullptr); }
+
+  // the other side's Get throws a std::runtime_error with what, truncated
+  // to 255 bytes.
+  bool SetException(const std::string &what) {
+    return slot_->Set(nullptr, &what);
+  }
+
+private:
+  explicit SharedMemoryPromise(
+      std::shared_ptr<future_internal::ShmSlot<T>> slot)
+      : slot_(std::move(slot)) {}
+
+  std::shared_ptr<future_internal::ShmSlot<T>> slot_;
+};
+
+// The waiting end of a SharedMemoryPromise. Get blocks on the futex in the
+// segment; ToFuture turns the result into a Future<T> through the Reactor,
+// so Then continuations run in this process once the eventfd is signalled.
+template <typename T> class SharedMemoryFuture {
+public:
+  static SharedMemoryFuture Create(const std::string &name) {
+    return SharedMemoryFuture(
+        std::make_shared<future_internal::ShmSlot<T>>(name, true, -1));
+  }
+
+  static SharedMemoryFuture Open(const std::string &name, int event_fd = -1) {
+    return SharedMemoryFuture(
+        std::make_shared<future_internal::ShmSlot<T>>(name, false, event_fd));
+  }
+
+  int EventFd() const { return slot_->EventFd(); }
+
+  bool IsReady() const { return slot_->IsReady(); }
+
+  T Get() {
+    slot_->Wait(nullptr);
+    return slot_->Read();
+  }
+
+  template <typename Rep, typename Period>
+  FutureStatus WaitFor(const std::chrono::duration<Rep, Period> &timeout) {
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count() +
+        deadline.tv_nsec;
+    deadline.tv_sec += ns / 1000000000ll;
+    deadline.tv_nsec = ns % 1000000000ll;
+    return slot_->Wait(&deadline) ? FutureStatus::Done : FutureStatus::Timeout;
+  }
+
+  // resolves on the reactor thread once the eventfd is signalled, or right
+  // away if the result is already there. Needs the eventfd, and takes its
+  // counter, so one ToFuture per eventfd.
+  Future<T> ToFuture(Reactor &reactor) {
+    auto slot = slot_;
+    if (slot->IsReady()) {
+      return MakeReadyFuture().Then(Lauch::Sync,
+                                    [slot] { return slot->Read(); });
+    }
+    if (slot->EventFd() < 0) {
+      return MakeExceptFuture<T>(std::make_exception_ptr(
+          std::logic_error("shared memory future without eventfd")));
+    }
+
+    auto counter = std::make_shared<uint64_t>(0);
+    return reactor.ReadAsync(slot->EventFd(), counter.get(), sizeof(uint64_t))
+        .Then(Lauch::Sync, [slot, counter](size_t) { return slot->Read(); });
+  }
+
+private:
+  explicit SharedMemoryFuture(std::shared_ptr<future_internal::ShmSlot<T>> slot)
+      : slot_(std::move(slot)) {}
+
+  std::shared_ptr<future_internal::ShmSlot<T>> slot_;
+};
+}
+#endif // __linux__
+#endif // FUTURE_DEMO_SHM_FUTURE_H
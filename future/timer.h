@@ -0,0 +1,206 @@
+#ifndef FUTURE_DEMO_TIMER_H
+#define FUTURE_DEMO_TIMER_H
+
+#include <map>
+#include <unordered_map>
+#include "future.h"
+
+namespace purecpp {
+// A single thread running callbacks at their deadline. Callbacks run on the
+// timer thread and should only hand work off (e.g. fulfil a promise or submit
+// to an executor), a slow callback delays every timer behind it.
+class Timer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  Timer() : thread_([this] { Run(); }) {}
+
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+
+  ~Timer() {
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    cond_var_.notify_all();
+    thread_.join();
+  }
+
+  // returns an id which can be passed to Cancel.
+  uint64_t Schedule(Clock::time_point when, std::function<void()> fn) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    uint64_t id = ++next_id_;
+    bool earliest = tasks_.empty() || when < tasks_.begin()->first.first;
+    tasks_.emplace(std::make_pair(when, id), std::move(fn));
+    index_.emplace(id, when);
+    lock.unlock();
+
+    if (earliest) {
+      cond_var_.notify_one();
+    }
+    return id;
+  }
+
+  template <typename Rep, typename Period>
+  uint64_t Schedule(const std::chrono::duration<Rep, Period> &delay,
+                    std::function<void()> fn) {
+    return Schedule(Clock::now() +
+                        std::chrono::duration_cast<Clock::duration>(delay),
+                    std::move(fn));
+  }
+
+  // returns false if the callback has already run or been cancelled.
+  bool Cancel(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    auto it = index_.find(id);
+    if (it == index_.end()) {
+      return false;
+    }
+
+    tasks_.erase(std::make_pair(it->second, id));
+    index_.erase(it);
+    return true;
+  }
+
+  static Timer &Default() {
+    static Timer timer;
+    return timer;
+  }
+
+private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+      if (tasks_.empty()) {
+        cond_var_.wait(lock);
+        continue;
+      }
+
+      auto first = tasks_.begin();
+      if (Clock::now() < first->first.first) {
+        cond_var_.wait_until(lock, first->first.first);
+        continue;
+      }
+
+      auto fn = std::move(first->second);
+      index_.erase(first->first.second);
+      tasks_.erase(first);
+      lock.unlock();
+      fn();
+      lock.lock();
+    }
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cond_var_;
+  std::map<std::pair<Clock::time_point, uint64_t>, std::function<void()>>
+      tasks_;
+  std::unordered_map<uint64_t, Clock::time_point> index_;
+  uint64_t next_id_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+// a future fulfilled on the default timer thread after delay.
+template <typename Rep, typename Period>
+inline Future<void> Delay(const std::chrono::duration<Rep, Period> &delay) {
+  Promise<void> promise;
+  auto future = promise.GetFuture();
+  Timer::Default().Schedule(delay, [promise]() mutable { promise.SetValue(); });
+  return future;
+}
+
+// Resolves once every input is ready or at deadline, whichever comes first,
+// with one entry per input in order: the Try of the input, or nullopt if it
+// had not arrived. No thread waits for the deadline, it is a timer callback;
+// inputs arriving after it are dropped after checking a flag.
+template <typename Iterator>
+inline Future<std::vector<absl::optional<
+    try_type_t<future_value_t<iterator_value_t<Iterator>>>>>>
+WhenAllWithin(Iterator begin, Iterator end, Timer::Clock::time_point deadline,
+              Timer &timer = Timer::Default()) {
+  using try_t = try_type_t<future_value_t<iterator_value_t<Iterator>>>;
+  using result_t = std::vector<absl::optional<try_t>>;
+
+  struct WithinContext {
+    explicit WithinContext(size_t n) : results(n), remaining(n) {}
+
+    // the first of the last arrival and the deadline publishes the results.
+    void Finish(std::unique_lock<std::mutex> &lock) {
+      done = true;
+      auto out = std::move(results);
+      uint64_t id = timer_id;
+      lock.unlock();
+      if (id && timer) {
+        timer->Cancel(id);
+      }
+      pm.SetValue(std::move(out));
+    }
+
+    Promise<result_t> pm;
+    std::atomic<bool> done{false};
+    std::mutex mtx;
+    result_t results;
+    size_t remaining;
+    Timer *timer = nullptr;
+    uint64_t timer_id = 0;
+  };
+
+  auto ctx = std::make_shared<WithinContext>(std::distance(begin, end));
+  auto future = ctx->pm.GetFuture();
+  for (size_t i = 0; begin != end; ++begin, ++i) {
+    begin->Then(Lauch::Sync, [ctx, i](try_t &&t) {
+      if (ctx->done.load(std::memory_order_acquire)) {
+        return;
+      }
+      std::unique_lock<std::mutex> lock(ctx->mtx);
+      if (ctx->done) {
+        return;
+      }
+      ctx->results[i].emplace(std::move(t));
+      if (--ctx->remaining == 0) {
+        ctx->Finish(lock);
+      }
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(ctx->mtx);
+  if (ctx->done) {
+    return future;
+  }
+  if (ctx->remaining == 0 || Timer::Clock::now() >= deadline) {
+    ctx->Finish(lock);
+    return future;
+  }
+  lock.unlock();
+
+  auto id = timer.Schedule(deadline, [ctx] {
+    std::unique_lock<std::mutex> lock(ctx->mtx);
+    if (!ctx->done) {
+      ctx->Finish(lock);
+    }
+  });
+  lock.lock();
+  if (!ctx->done) {
+    ctx->timer = &timer;
+    ctx->timer_id = id;
+  }
+  lock.unlock();
+  return future;
+}
+
+template <typename Iterator, typename Rep, typename Period>
+inline Future<std::vector<absl::optional<
+    try_type_t<future_value_t<iterator_value_t<Iterator>>>>>>
+WhenAllWithin(Iterator begin, Iterator end,
+              const std::chrono::duration<Rep, Period> &timeout,
+              Timer &timer = Timer::Default()) {
+  return WhenAllWithin(
+      begin, end,
+      Timer::Clock::now() +
+          std::chrono::duration_cast<Timer::Clock::duration>(timeout),
+      timer);
+}
+}
+#endif // FUTURE_DEMO_TIMER_H
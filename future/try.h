@@ -93,7 +93,7 @@ public:
   template <typename R> R Get() { return std::forward<R>(Value()); }
 
 private:
-  void Check() {
+  void Check() const {
     if (HasException()) {
       std::rethrow_exception(absl::get<2>(val_));
     } else if (NotInit()) {
@@ -114,6 +114,18 @@ public:
 
   bool HasException() const { return val_.index() == 1; }
 
+  std::exception_ptr &Exception() {
+    if (!HasException()) {
+      throw std::logic_error("not exception");
+    }
+
+#if __cplusplus < 201703L
+    return absl::get<1>(val_);
+#else
+    return std::get<1>(val_);
+#endif
+  }
+
   template <typename R> R Get() { return std::forward<R>(*this); }
 
 private:
@@ -0,0 +1,255 @@
+// Allocation budgets of the public operations: the global operator new and
+// delete are replaced by counting ones and every scenario below is run once
+// to warm up (lazily built statics) and then measured. It exits non-zero
+// when a scenario allocates more than its budget, so a change adding an
+// allocation to Async, Then, SetValue, MakeReadyFuture or a combinator
+// fails here. A scenario allocating less is reported, lower its budget in
+// the same change. Only the allocations of the measuring thread are
+// counted: Async, Then with the default Lauch::Async and the combinators,
+// which attach their continuations that way, start a thread per task, and
+// what those threads allocate would make the counts racy. Starting them is
+// counted; the other scenarios use executors which run tasks inline.
+//
+//   future_alloc [-v]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <future/future.h>
+#include <future/promise_array.h>
+
+using namespace purecpp;
+
+namespace {
+thread_local size_t t_allocs = 0;
+
+void *Allocate(size_t size) {
+  t_allocs++;
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+}
+
+void *operator new(size_t size) { return Allocate(size); }
+void *operator new[](size_t size) { return Allocate(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+
+namespace {
+int g_failures = 0;
+bool g_verbose = false;
+
+// runs tasks on the submitting thread, fused into Then chains.
+struct InlineExecutor {
+  static constexpr bool is_inline = true;
+  template <typename F> void execute(F &&f) { f(); }
+};
+
+// runs tasks on the submitting thread too, but Then takes the executor path.
+struct DirectExecutor {
+  template <typename F> void execute(F &&f) { f(); }
+};
+
+template <typename F> size_t CountAllocs(F &&scenario) {
+  scenario();
+  size_t before = t_allocs;
+  scenario();
+  return t_allocs - before;
+}
+
+#define ALLOC_BUDGET(name, budget, ...)                                        \
+  do {                                                                         \
+    size_t n = CountAllocs([&] { __VA_ARGS__; });                              \
+    if (n > (budget)) {                                                        \
+      std::fprintf(stderr, "%-28s %3zu allocations, budget %d: FAILED\n",      \
+                   name, n, budget);                                           \
+      g_failures++;                                                            \
+    } else if (n < (budget)) {                                                 \
+      std::printf("%-28s %3zu allocations, budget %d: lower the budget\n",     \
+                  name, n, budget);                                            \
+    } else if (g_verbose) {                                                    \
+      std::printf("%-28s %3zu allocations\n", name, n);                        \
+    }                                                                          \
+  } while (0)
+
+#define ALLOC_CHECK(cond)                                                      \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                   #cond);                                                     \
+      g_failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+std::vector<Future<int>> ReadyFutures(size_t n) {
+  std::vector<Future<int>> futures;
+  futures.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    futures.push_back(MakeReadyFuture(int(i)));
+  }
+  return futures;
+}
+}
+
+int main(int argc, char **argv) {
+  g_verbose = argc > 1 && std::strcmp(argv[1], "-v") == 0;
+  InlineExecutor inline_ex;
+  DirectExecutor direct_ex;
+
+  // creating and fulfilling futures.
+  ALLOC_BUDGET("Promise::SetValue", 1, {
+    Promise<int> promise;
+    auto future = promise.GetFuture();
+    promise.SetValue(1);
+    ALLOC_CHECK(future.Get() == 1);
+  });
+  ALLOC_BUDGET("MakeReadyFuture", 1,
+               ALLOC_CHECK(MakeReadyFuture(1).Get() == 1));
+  ALLOC_BUDGET("MakeReadyFuture<void>", 1, MakeReadyFuture().Get());
+  ALLOC_BUDGET("MakeExceptFuture", 2, {
+    auto future = MakeExceptFuture<int>(std::runtime_error("x"));
+    future.Wait();
+  });
+  ALLOC_BUDGET("Async(thread)", 2,
+               ALLOC_CHECK(Async([] { return 1; }).Get() == 1));
+  ALLOC_BUDGET("Async(inline executor)", 1,
+               ALLOC_CHECK(Async(&inline_ex, [] { return 1; }).Get() == 1));
+
+  // continuations.
+  ALLOC_BUDGET("Then(Sync) on pending", 4, {
+    Promise<int> promise;
+    auto future =
+        promise.GetFuture().Then(Lauch::Sync, [](int i) { return i + 1; });
+    promise.SetValue(0);
+    ALLOC_CHECK(future.Get() == 1);
+  });
+  // the value is not copied into a callback taking it by reference.
+  ALLOC_BUDGET("Then(Async) on pending", 8, {
+    Promise<int> promise;
+    auto future = promise.GetFuture().Then([](int i) { return i + 1; });
+    promise.SetValue(0);
+    ALLOC_CHECK(future.Get() == 1);
+  });
+  ALLOC_BUDGET("Then(Sync) string by ref", 5, {
+    Promise<std::string> promise;
+    auto future = promise.GetFuture().Then(
+        Lauch::Sync, [](const std::string &s) { return s.size(); });
+    promise.SetValue(std::string(64, 'x'));
+    ALLOC_CHECK(future.Get() == 64);
+  });
+  ALLOC_BUDGET("Then(executor) string by ref", 5, {
+    Promise<std::string> promise;
+    auto future = promise.GetFuture().Then(
+        &direct_ex, [](const std::string &s) { return s.size(); });
+    promise.SetValue(std::string(64, 'x'));
+    ALLOC_CHECK(future.Get() == 64);
+  });
+  ALLOC_BUDGET("Then(Sync) x3 on pending", 6, {
+    Promise<int> promise;
+    auto future = promise.GetFuture()
+                      .Then(Lauch::Sync, [](int i) { return i + 1; })
+                      .Then(Lauch::Sync, [](int i) { return i + 1; })
+                      .Then(Lauch::Sync, [](int i) { return i + 1; });
+    promise.SetValue(0);
+    ALLOC_CHECK(future.Get() == 3);
+  });
+  ALLOC_BUDGET("Then(Sync) x3 on ready", 4, {
+    auto future = MakeReadyFuture(0)
+                      .Then(Lauch::Sync, [](int i) { return i + 1; })
+                      .Then(Lauch::Sync, [](int i) { return i + 1; })
+                      .Then(Lauch::Sync, [](int i) { return i + 1; });
+    ALLOC_CHECK(future.Get() == 3);
+  });
+  ALLOC_BUDGET("Then(inline executor)", 4, {
+    Promise<int> promise;
+    auto future = promise.GetFuture().Then(&inline_ex,
+                                           [](int i) { return i + 1; });
+    promise.SetValue(0);
+    ALLOC_CHECK(future.Get() == 1);
+  });
+  ALLOC_BUDGET("Then(executor)", 4, {
+    Promise<int> promise;
+    auto future = promise.GetFuture().Then(&direct_ex,
+                                           [](int i) { return i + 1; });
+    promise.SetValue(0);
+    ALLOC_CHECK(future.Get() == 1);
+  });
+  ALLOC_BUDGET("Then(Try) on exception", 5, {
+    Promise<int> promise;
+    auto future = promise.GetFuture().Then(
+        Lauch::Sync, [](Try<int> &&t) { return t.HasException() ? 1 : 0; });
+    promise.SetException(std::make_exception_ptr(std::runtime_error("x")));
+    ALLOC_CHECK(future.Get() == 1);
+  });
+
+  // combinators over 8 futures, the budgets include building the inputs.
+  ALLOC_BUDGET("WhenAll(8 ready)", 52, {
+    auto futures = ReadyFutures(8);
+    auto all = WhenAll(futures.begin(), futures.end());
+    ALLOC_CHECK(all.Get().size() == 8);
+  });
+  ALLOC_BUDGET("WhenAll(8 pending)", 69, {
+    std::vector<Promise<int>> promises(8);
+    std::vector<Future<int>> futures;
+    futures.reserve(8);
+    for (auto &p : promises) {
+      futures.push_back(p.GetFuture());
+    }
+    auto all = WhenAll(futures.begin(), futures.end());
+    for (auto &p : promises) {
+      p.SetValue(1);
+    }
+    ALLOC_CHECK(all.Get().size() == 8);
+  });
+  ALLOC_BUDGET("WhenAny(8 ready)", 51, {
+    auto futures = ReadyFutures(8);
+    auto any = WhenAny(futures.begin(), futures.end());
+    ALLOC_CHECK(any.Get().first < 8);
+  });
+  ALLOC_BUDGET("WhenAllReduce(8 ready)", 27, {
+    auto futures = ReadyFutures(8);
+    auto sum = WhenAllReduce(futures.begin(), futures.end(), 0,
+                             [](int acc, int i) { return acc + i; });
+    ALLOC_CHECK(sum.Get() == 28);
+  });
+  ALLOC_BUDGET("WhenAllInto(8 ready)", 19, {
+    auto futures = ReadyFutures(8);
+    int out[8];
+    WhenAllInto(futures.begin(), futures.end(), out).Get();
+    ALLOC_CHECK(out[7] == 7);
+  });
+  ALLOC_BUDGET("WhenAll(variadic 3)", 20, {
+    auto all = WhenAll(MakeReadyFuture(1), MakeReadyFuture(2.0),
+                       MakeReadyFuture(std::string()));
+    ALLOC_CHECK(std::get<0>(all.Get()) == 1);
+  });
+  ALLOC_BUDGET("PromiseArray(64) SetValues", 1, {
+    PromiseArray<int> promises(64);
+    int values[64] = {};
+    promises.SetValues(0, values, values + 64);
+  });
+
+  if (g_failures) {
+    std::fprintf(stderr, "%d allocation checks failed\n", g_failures);
+    return 1;
+  }
+  std::printf("allocation budgets ok\n");
+  return 0;
+}
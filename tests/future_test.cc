@@ -1,7 +1,34 @@
 #include <iostream>
+#include <numeric>
+#include <set>
 #include <gtest/gtest.h>
 #include <boost/thread/executors/basic_thread_pool.hpp>
 #include <future/future.h>
+#include <future/bounded_executor.h>
+#include <future/serial_executor.h>
+#include <future/channel.h>
+#include <future/async_sync.h>
+#include <future/async_cache.h>
+#include <future/batcher.h>
+#include <future/retry.h>
+#include <future/hedge.h>
+#include <future/semi_future.h>
+#include <future/promise_array.h>
+#include <future/fiber_executor.h>
+#include <future/asio.h>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <future/reactor.h>
+#include <future/shm_future.h>
+#endif
 
 using namespace purecpp;
 
@@ -267,6 +294,162 @@ TEST(when_all, when_all_in_thread){
     t.join();
 }
 
+TEST(when_all, reduce){
+  const int n = 1000;
+  std::vector<Promise<int>> promises(n);
+  std::vector<Future<int>> futures;
+  for (auto &p : promises) {
+    futures.push_back(p.GetFuture());
+  }
+
+  auto sum = WhenAllReduce(futures.begin(), futures.end(), int64_t(0),
+                           [](int64_t acc, int v) { return acc + v; });
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&promises, t] {
+      for (int i = t; i < n; i += 4) {
+        promises[i].SetValue(i);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(sum.Get(), int64_t(n) * (n - 1) / 2);
+
+  std::vector<Future<int>> empty;
+  EXPECT_EQ(WhenAllReduce(empty.begin(), empty.end(), 7,
+                          [](int acc, int v) { return acc + v; }).Get(), 7);
+}
+
+TEST(when_all, reduce_exception){
+  Promise<int> p1;
+  Promise<int> p2;
+  std::vector<Future<int>> futures;
+  futures.emplace_back(p1.GetFuture());
+  futures.emplace_back(p2.GetFuture());
+
+  auto f = WhenAllReduce(futures.begin(), futures.end(), 0,
+                         [](int acc, int v) { return acc + v; });
+  p1.SetException(std::make_exception_ptr(std::runtime_error("failed")));
+  EXPECT_THROW(f.Get(), std::runtime_error);
+  p2.SetValue(1);
+}
+
+struct NoDefault {
+  explicit NoDefault(int v) : value(v) {}
+  int value;
+};
+
+TEST(when_all, into){
+  std::vector<Promise<NoDefault>> promises(3);
+  std::vector<Future<NoDefault>> futures;
+  for (auto &p : promises) {
+    futures.push_back(p.GetFuture());
+  }
+
+  std::vector<NoDefault> out(3, NoDefault(0));
+  auto done = WhenAllInto(futures.begin(), futures.end(), out.begin());
+  promises[2].SetValue(NoDefault(3));
+  promises[0].SetValue(NoDefault(1));
+  promises[1].SetValue(NoDefault(2));
+  done.Get();
+  EXPECT_EQ(out[0].value, 1);
+  EXPECT_EQ(out[1].value, 2);
+  EXPECT_EQ(out[2].value, 3);
+
+  {
+    Promise<int> p1;
+    Promise<int> p2;
+    std::vector<Future<int>> futures;
+    futures.emplace_back(p1.GetFuture());
+    futures.emplace_back(p2.GetFuture());
+    int out[2] = {0, 0};
+    // a WaitFor timing out would leave done failed with its own error.
+    bool finished = false;
+    auto done = WhenAllInto(futures.begin(), futures.end(), out)
+                    .Then(Lauch::Sync, [&finished](Try<void> &&t) {
+                      finished = true;
+                      if (t.HasException()) {
+                        std::rethrow_exception(t.Exception());
+                      }
+                    });
+    p2.SetException(std::make_exception_ptr(std::runtime_error("failed")));
+    EXPECT_FALSE(finished);
+    p1.SetValue(1);
+    EXPECT_TRUE(finished);
+    try {
+      done.Get();
+      FAIL();
+    } catch (const std::runtime_error &e) {
+      EXPECT_STREQ(e.what(), "failed");
+    }
+    EXPECT_EQ(out[0], 1);
+  }
+}
+
+TEST(promise_array, set_values){
+  PromiseArray<int> promises(100);
+  auto futures = promises.GetFutures();
+  std::atomic<int> ran(0);
+  for (auto &f : futures) {
+    f.Then(Lauch::Sync, [&ran](int) { ran++; });
+  }
+
+  std::thread waiter([&futures] { EXPECT_EQ(futures[99].Get(), 99); });
+  std::vector<int> values(100);
+  std::iota(values.begin(), values.end(), 0);
+  promises.SetValues(0, values.begin(), values.end());
+  waiter.join();
+
+  EXPECT_EQ(ran, 100);
+  EXPECT_EQ(futures[7].Get(), 7);
+  promises.SetValue(7, 70);
+  EXPECT_EQ(futures[8].Get(), 8);
+}
+
+TEST(promise_array, when_all_when_any){
+  PromiseArray<std::string> promises(3);
+  auto any = promises.WhenAny();
+  auto all = promises.WhenAll();
+  promises.SetValue(2, std::string("c"));
+  EXPECT_EQ(any.Get(), std::make_pair(size_t(2), std::string("c")));
+
+  std::vector<std::string> rest = {"a", "b"};
+  promises.SetValues(0, rest.begin(), rest.end());
+  EXPECT_EQ(all.Get(), (std::vector<std::string>{"a", "b", "c"}));
+
+  // asked for after the fact
+  EXPECT_EQ(promises.WhenAll().Get().size(), 3u);
+  EXPECT_EQ(promises.WhenAny().Get().first, 2u);
+
+  PromiseArray<int> failing(2);
+  auto failed = failing.WhenAll();
+  failing.SetException(1, std::make_exception_ptr(std::runtime_error("x")));
+  failing.SetValue(0, 1);
+  EXPECT_THROW(failed.Get(), std::runtime_error);
+
+  // an element whose future timed out is still counted.
+  PromiseArray<int> timed_out(2);
+  auto first = timed_out.GetFuture(0);
+  EXPECT_EQ(first.WaitFor(std::chrono::milliseconds(1)), FutureStatus::Timeout);
+  auto late = timed_out.WhenAll();
+  timed_out.SetValue(0, 1);
+  timed_out.SetValue(1, 2);
+  ASSERT_EQ(late.WaitFor(std::chrono::seconds(5)), FutureStatus::Done);
+  EXPECT_EQ(late.Get(), (std::vector<int>{1, 2}));
+  EXPECT_EQ(timed_out.WhenAny().Get().first, 0u);
+
+  // the handed out futures also work with the generic combinators
+  PromiseArray<int> generic(2);
+  auto futures = generic.GetFutures();
+  auto sum = WhenAllReduce(futures.begin(), futures.end(), 0,
+                           [](int acc, int v) { return acc + v; });
+  generic.SetValue(0, 1);
+  generic.SetValue(1, 2);
+  EXPECT_EQ(sum.Get(), 3);
+}
+
 TEST(when_all, when_all_variadic){
   Promise<int> p1;
   Promise<void> p2;
@@ -414,6 +597,174 @@ TEST(future_then, sync_then){
   EXPECT_TRUE(f.Get());
 }
 
+TEST(future_then, argument_shapes){
+  auto none = MakeReadyFuture(1).Then(Lauch::Sync, []{ return 2; });
+  EXPECT_EQ(none.Get(), 2);
+
+  auto value = MakeReadyFuture(1).Then(Lauch::Sync, [](const int &i){ return i + 2; });
+  EXPECT_EQ(value.Get(), 3);
+
+  auto try_ref = MakeReadyFuture(1).Then(Lauch::Sync, [](Try<int> &&t){ return t.Value() + 3; });
+  EXPECT_EQ(try_ref.Get(), 4);
+
+  int called = 0;
+  auto try_void = MakeReadyFuture().Then(Lauch::Sync, [&called](Try<void> t){
+    called += t.HasValue();
+  });
+  try_void.Get();
+  EXPECT_EQ(called, 1);
+}
+
+TEST(future_then, deep_inline_chain){
+  // every continuation fulfils the next promise from inside SetValue, the
+  // nesting is cut by the trampoline instead of growing the stack.
+  const int n = 200000;
+  std::vector<Promise<int>> promises(n + 1);
+  std::vector<Future<void>> stages;
+  for (int i = 0; i < n; i++) {
+    stages.push_back(promises[i].GetFuture().Then(
+        Lauch::Sync, [&promises, i](int v) { promises[i + 1].SetValue(v + 1); }));
+  }
+  auto last = promises[n].GetFuture();
+  auto caller = std::this_thread::get_id();
+  auto on_caller = last.Then(Lauch::Sync, [caller](int v) {
+    return std::make_pair(v, std::this_thread::get_id() == caller);
+  });
+
+  promises[0].SetValue(0);
+  auto result = on_caller.Get();
+  EXPECT_EQ(result.first, n);
+  EXPECT_TRUE(result.second);
+}
+
+TEST(future_then, wait_runs_deferred_continuations){
+  // past the inline depth, the continuation of inner is deferred to the
+  // trampoline; Get must run it instead of waiting for it forever.
+  const int n = 64;
+  std::vector<Promise<int>> promises(n + 1);
+  std::vector<Future<void>> stages;
+  Promise<int> inner;
+  auto inner_done = inner.GetFuture().Then(Lauch::Sync, [](int v) { return v; });
+  int got = 0;
+  for (int i = 0; i < n; i++) {
+    stages.push_back(promises[i].GetFuture().Then(
+        Lauch::Sync, [&promises, i](int v) { promises[i + 1].SetValue(v + 1); }));
+  }
+  auto last = promises[n].GetFuture().Then(Lauch::Sync, [&](int) {
+    inner.SetValue(42);
+    got = inner_done.Get();
+  });
+
+  promises[0].SetValue(0);
+  last.Get();
+  EXPECT_EQ(got, 42);
+}
+
+TEST(future_then, unwrap_returned_future){
+  Promise<int> p1;
+  Promise<std::string> p2;
+  auto p2_future = MakeMoveWrapper(p2.GetFuture());
+  Future<std::string> f = p1.GetFuture().Then([p2_future](int v) mutable {
+    EXPECT_EQ(v, 1);
+    return p2_future.move();
+  });
+  p1.SetValue(1);
+  p2.SetValue(std::string("page"));
+  EXPECT_EQ(f.Get(), "page");
+
+  Future<void> v = MakeReadyFuture(1).Then(Lauch::Sync, [](int) {
+    return MakeReadyFuture();
+  });
+  v.Get();
+
+  Future<int> e = MakeReadyFuture(1).Then(Lauch::Sync, [](int) {
+    return MakeExceptFuture<int>(std::runtime_error("inner"));
+  });
+  EXPECT_THROW(e.Get(), std::runtime_error);
+
+  Future<int> fused = MakeReadyFuture(1).Then(Lauch::Sync, [](int v) {
+    return MakeReadyFuture(int(v)).Then(Lauch::Sync,
+                                        [](int v) { return v + 1; });
+  });
+  EXPECT_EQ(fused.Get(), 2);
+}
+
+Future<int> FetchPages(boost::executors::basic_thread_pool *pool, int page,
+                       int total) {
+  return Async(pool, [page] { return page; })
+      .Then(Lauch::Sync, [pool, page, total](int v) -> Future<int> {
+        if (page + 1 == total) {
+          return MakeReadyFuture(int(v));
+        }
+        return FetchPages(pool, page + 1, total).Then(
+            Lauch::Sync, [v](int rest) { return v + rest; });
+      });
+}
+
+TEST(future_then, unwrap_async_recursion){
+  // every page is fetched on the pool and the next fetch is started from
+  // its continuation, no thread blocks on an inner future.
+  boost::executors::basic_thread_pool pool(2);
+  const int pages = 1000;
+  EXPECT_EQ(FetchPages(&pool, 0, pages).Get(), pages * (pages - 1) / 2);
+}
+
+TEST(future_then, fused_sync_chain){
+  Promise<int> promise;
+  auto future = promise.GetFuture();
+  std::vector<int> seen;
+  auto f = future.Then(Lauch::Sync, [&seen](int x){
+    seen.push_back(x);
+    return x + 1;
+  });
+  for (int i = 0; i < 9; i++) {
+    f = f.Then(Lauch::Sync, [&seen](int x){
+      seen.push_back(x);
+      return x + 1;
+    });
+  }
+
+  // the stages run on the thread which completes the promise.
+  promise.SetValue(0);
+  EXPECT_EQ(seen.size(), size_t(10));
+  EXPECT_EQ(f.Get(), 10);
+
+  // appending to a chain which already ran runs the stage inline.
+  auto ready = MakeReadyFuture(1).Then(Lauch::Sync, [](int x){ return x * 2; });
+  auto next = ready.Then(Lauch::Sync, [](int x){ return x * 3; });
+  EXPECT_EQ(ready.Get(), 2);
+  EXPECT_EQ(next.Get(), 6);
+}
+
+TEST(future_then, fused_sync_exception){
+  Promise<int> promise;
+  auto f = promise.GetFuture().Then(Lauch::Sync, [](int x){
+    throw std::runtime_error("error");
+    return x;
+  }).Then(Lauch::Sync, [](int x){
+    return x + 1;
+  });
+  auto recovered = f.Then(Lauch::Sync, [](Try<int> t){
+    return t.HasException() ? -1 : t.Value();
+  });
+
+  promise.SetValue(1);
+  EXPECT_EQ(recovered.Get(), -1);
+  EXPECT_THROW(f.Get(), std::exception);
+}
+
+TEST(future_then, fused_sync_then_async){
+  Promise<int> promise;
+  auto f = promise.GetFuture()
+               .Then(Lauch::Sync, [](int x){ return x + 1; })
+               .Then(Lauch::Sync, [](int x){ return x * 2; })
+               .Then([](int x){ return x + 1; });
+
+  std::thread thd([&promise]{ promise.SetValue(1); });
+  EXPECT_EQ(f.Get(), 5);
+  thd.join();
+}
+
 TEST(future_then_pool, async_pool){
   boost::basic_thread_pool pool(4);
   auto future = Async(&pool, []{
@@ -459,6 +810,99 @@ TEST(future_then_pool, adaptor_pool){
   EXPECT_EQ(val, 0);
 }
 
+struct InlineExecutor {
+  static constexpr bool is_inline = true;
+  template <typename F> void execute(F &&f) {
+    executed++;
+    f();
+  }
+  int executed = 0;
+};
+
+// fails to compile if a task reaches it type erased.
+struct TypedExecutor {
+  template <typename F> void execute(F &&f) {
+    static_assert(
+        !std::is_same<absl::decay_t<F>, std::function<void()>>::value,
+        "task was type erased");
+    tasks++;
+    f();
+  }
+  int tasks = 0;
+};
+
+struct BulkExecutor : TypedExecutor {
+  template <typename F> void bulk_execute(size_t n, F &&f) {
+    bulks++;
+    for (size_t i = 0; i < n; i++) {
+      f(i);
+    }
+  }
+  int bulks = 0;
+};
+
+TEST(executor, traits) {
+  static_assert(is_executor<ExecutorAdaptor<boost::basic_thread_pool>>::value,
+                "");
+  static_assert(is_executor<EmptyExecutor>::value, "");
+  static_assert(is_executor<FiberExecutor>::value, "");
+  static_assert(is_executor<TypedExecutor>::value, "");
+  static_assert(!is_executor<int>::value, "");
+  static_assert(!is_executor<std::string>::value, "");
+  static_assert(is_inline_executor<InlineExecutor>::value, "");
+  static_assert(!is_inline_executor<TypedExecutor>::value, "");
+  static_assert(!is_inline_executor<EmptyExecutor>::value, "");
+}
+
+TEST(executor, typed_tasks) {
+  TypedExecutor ex;
+  auto f = Async(&ex, [] { return 1; }).Then(&ex, [](int i) { return i + 1; });
+  EXPECT_EQ(f.Get(), 2);
+  EXPECT_EQ(ex.tasks, 2);
+
+  ExecutorAdaptor<boost::basic_thread_pool> pool(2);
+  auto g = Async(&pool, [] { return 40; })
+               .Then(&pool, [](int i) { return MakeReadyFuture(i + 2); });
+  EXPECT_EQ(g.Get(), 42);
+}
+
+TEST(executor, inline_then_is_fused) {
+  InlineExecutor ex;
+  Promise<int> promise;
+  auto f = promise.GetFuture()
+               .Then(&ex, [](int i) { return i + 1; })
+               .Then(&ex, [](int i) { return i * 2; });
+  int seen = 0;
+  Promise<int> other;
+  other.GetFuture().Then(&ex, [&seen](int i) { seen = i; });
+
+  promise.SetValue(1);
+  other.SetValue(5);
+  EXPECT_EQ(f.Get(), 4);
+  EXPECT_EQ(seen, 5);
+  EXPECT_EQ(ex.executed, 0);
+
+  // a returned future can't be fused, the task goes through execute.
+  auto g = MakeReadyFuture(1).Then(
+      &ex, [](int i) { return MakeReadyFuture(i + 1); });
+  EXPECT_EQ(g.Get(), 2);
+  EXPECT_EQ(ex.executed, 1);
+}
+
+TEST(executor, bulk_execute) {
+  std::vector<int> out(8);
+  BulkExecutor bulk;
+  BulkExecute(bulk, out.size(), [&out](size_t i) { out[i] = (int)i; });
+  EXPECT_EQ(bulk.bulks, 1);
+  EXPECT_EQ(bulk.tasks, 0);
+  EXPECT_EQ(std::accumulate(out.begin(), out.end(), 0), 28);
+
+  TypedExecutor ex;
+  BulkExecute(ex, out.size(), [&out](size_t i) { out[i] = (int)i * 2; });
+  EXPECT_EQ(ex.tasks, 8);
+  EXPECT_EQ(std::accumulate(out.begin(), out.end(), 0), 56);
+}
+
 TEST(future_then_policy, lauch){
   auto future = Async([]{return 42;});
   auto f = future.Then(Lauch::Sync, [](int i){
@@ -535,6 +979,42 @@ TEST(future_wait, timeout){
   }
 }
 
+TEST(future_wait, shared_parking_slots){
+  // more waiters than parking slots, so unrelated states share a slot.
+  const int n = 200;
+  std::vector<Promise<int>> promises(n);
+  std::vector<Future<int>> futures;
+  std::vector<std::thread> waiters;
+  std::atomic<int> sum(0);
+  for (int i = 0; i < n; i++) {
+    futures.push_back(promises[i].GetFuture());
+  }
+  for (int i = 0; i < n; i++) {
+    waiters.emplace_back([&sum, &futures, i] { sum += futures[i].Get(); });
+  }
+
+  for (int i = n - 1; i >= 0; i--) {
+    promises[i].SetValue(i);
+  }
+  for (auto &t : waiters) {
+    t.join();
+  }
+  EXPECT_EQ(sum, n * (n - 1) / 2);
+}
+
+TEST(shared_state, layout){
+  // the blocking wait machinery lives in the parking lot, not in the state.
+  size_t base = sizeof(std::mutex) + sizeof(std::vector<std::function<void()>>);
+  EXPECT_LE(sizeof(SharedState<int>), base + sizeof(Try<int>) + 8);
+  EXPECT_LE(sizeof(SharedState<void>), base + sizeof(Try<void>) + 8);
+  EXPECT_EQ(sizeof(FutureStatus), 1u);
+#if defined(__GLIBCXX__) && defined(__x86_64__)
+  // the default build; a new member has to pay for itself elsewhere.
+  EXPECT_LE(sizeof(SharedState<int>), 88u);
+  EXPECT_LE(sizeof(SharedState<void>), 88u);
+#endif
+}
+
 TEST(future_wait, not_timeout){
   auto future = Async([]{
     std::this_thread::sleep_for(std::chrono::milliseconds (10));
@@ -640,6 +1120,1200 @@ TEST(future_then, finally){
   }
 }
 
+TEST(bounded_executor, limits_concurrency){
+  boost::basic_thread_pool pool(4);
+  BoundedExecutor<boost::basic_thread_pool> ex(&pool, 2, 2);
+
+  std::atomic<int> running{0};
+  std::atomic<int> max_running{0};
+  std::atomic<int> done{0};
+  std::vector<Future<void>> admitted;
+  for (int i = 0; i < 20; i++) {
+    admitted.emplace_back(ex.SubmitAsync([&] {
+      int now = ++running;
+      int prev = max_running;
+      while (now > prev && !max_running.compare_exchange_weak(prev, now)) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      running--;
+      done++;
+    }));
+  }
+
+  for (auto &f : admitted) {
+    f.Get();
+  }
+  while (done != 20) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_LE(max_running.load(), 2);
+  EXPECT_EQ(ex.Parked(), size_t(0));
+  // the last tasks may still be in OnFinish, ex must outlive them.
+  pool.close();
+  pool.join();
+
+  EXPECT_THROW(BoundedExecutor<boost::basic_thread_pool>(&pool, 0, 1),
+               std::invalid_argument);
+}
+
+TEST(bounded_executor, try_submit){
+  boost::basic_thread_pool pool(2);
+  BoundedExecutor<boost::basic_thread_pool> ex(&pool, 1, 1);
+
+  Promise<void> gate;
+  auto gate_future = gate.GetFuture();
+  auto blocked = MakeMoveWrapper(std::move(gate_future));
+  EXPECT_NO_THROW(ex.TrySubmit([blocked]() mutable { blocked->Wait(); }).Get());
+  EXPECT_NO_THROW(ex.TrySubmit([] {}).Get());
+  EXPECT_THROW(ex.TrySubmit([] {}).Get(), std::runtime_error);
+
+  auto parked = ex.SubmitAsync([] {});
+  EXPECT_EQ(parked.WaitFor(std::chrono::milliseconds(10)), FutureStatus::Timeout);
+  EXPECT_EQ(ex.Parked(), size_t(1));
+
+  auto admitted = ex.SubmitAsync([] {});
+  gate.SetValue();
+  admitted.Wait();
+  EXPECT_EQ(ex.Parked(), size_t(0));
+  // a closed pool rejects the queued task, so let it drain first.
+  while (ex.Running() != 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  pool.close();
+  pool.join();
+}
+
+TEST(bounded_executor, for_each_async){
+  boost::basic_thread_pool pool(4);
+  std::vector<int> input(100);
+  for (int i = 0; i < 100; i++) {
+    input[i] = i;
+  }
+
+  std::atomic<int> sum{0};
+  std::atomic<int> running{0};
+  std::atomic<int> max_running{0};
+  auto future = ForEachAsync(&pool, input, 3, [&](int i) {
+    int now = ++running;
+    int prev = max_running;
+    while (now > prev && !max_running.compare_exchange_weak(prev, now)) {
+    }
+    sum += i;
+    running--;
+  });
+
+  future.Get();
+  EXPECT_EQ(sum.load(), 4950);
+  EXPECT_LE(max_running.load(), 3);
+
+  auto failed = ForEachAsync(&pool, input, 3, [](int i) {
+    if (i == 10) {
+      throw std::runtime_error("error");
+    }
+  });
+  EXPECT_THROW(failed.Get(), std::runtime_error);
+  EXPECT_THROW(ForEachAsync(&pool, input, 0, [](int) {}).Get(),
+               std::invalid_argument);
+}
+
+// counts the tasks handed to the pool.
+struct CountingExecutor {
+  template <typename F> void execute(F &&f) {
+    submitted++;
+    pool->execute(std::forward<F>(f));
+  }
+
+  ExecutorAdaptor<boost::basic_thread_pool> *pool;
+  std::atomic<int> submitted{0};
+};
+
+TEST(serial_executor, fifo_without_overlap){
+  ExecutorAdaptor<boost::basic_thread_pool> pool(4);
+  CountingExecutor counting;
+  counting.pool = &pool;
+  SerialExecutor<CountingExecutor> serial(&counting);
+
+  const int producers = 4;
+  const int per_producer = 5000;
+  std::vector<int> last(producers, -1);
+  int inside = 0;
+  bool overlapped = false;
+  bool reordered = false;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      for (int i = 0; i < per_producer; i++) {
+        serial.execute([&, p, i] {
+          if (++inside != 1) {
+            overlapped = true;
+          }
+          if (last[p] != i - 1) {
+            reordered = true;
+          }
+          last[p] = i;
+          inside--;
+        });
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  // a task submitted last runs last.
+  auto done = Async(&serial, [&last] {
+    return std::accumulate(last.begin(), last.end(), 0);
+  });
+  EXPECT_EQ(done.Get(), producers * (per_producer - 1));
+  EXPECT_FALSE(overlapped);
+  EXPECT_FALSE(reordered);
+  // drained in batches, not one pool task per task.
+  EXPECT_LT(counting.submitted, producers * per_producer);
+}
+
+TEST(serial_executor, then_chains){
+  ExecutorAdaptor<boost::basic_thread_pool> pool(4);
+  SerialExecutor<ExecutorAdaptor<boost::basic_thread_pool>> serial(&pool, 8);
+  int shared = 0;
+  std::vector<Future<void>> futures;
+  for (int i = 0; i < 100; i++) {
+    futures.push_back(Async(&pool, [] {}).Then(&serial, [&shared] {
+      shared++;
+    }));
+  }
+  for (auto &f : futures) {
+    f.Get();
+  }
+  EXPECT_EQ(shared, 100);
+}
+
+// keeps the tasks until RunAll.
+struct ManualExecutor {
+  void execute(std::function<void()> f) { tasks.push_back(std::move(f)); }
+
+  void RunAll() {
+    while (!tasks.empty()) {
+      auto task = std::move(tasks.front());
+      tasks.erase(tasks.begin());
+      task();
+    }
+  }
+
+  std::vector<std::function<void()>> tasks;
+};
+
+TEST(serial_executor, destroyed_with_queued_drain){
+  ManualExecutor manual;
+  std::vector<int> order;
+  {
+    SerialExecutor<ManualExecutor> serial(&manual);
+    for (int i = 0; i < 3; i++) {
+      serial.execute([&order, i] { order.push_back(i); });
+    }
+    EXPECT_EQ(manual.tasks.size(), 1u);
+  }
+  // the drain owns the queue and still runs what was submitted.
+  manual.RunAll();
+  EXPECT_EQ(order, (std::vector<int>{0, 1, 2}));
+}
+
+TEST(timer, delay){
+  auto start = std::chrono::steady_clock::now();
+  Delay(std::chrono::milliseconds(20)).Get();
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+  std::atomic<int> fired{0};
+  auto id = Timer::Default().Schedule(std::chrono::milliseconds(10), [&] { fired++; });
+  EXPECT_TRUE(Timer::Default().Cancel(id));
+  EXPECT_FALSE(Timer::Default().Cancel(id));
+  Delay(std::chrono::milliseconds(20)).Get();
+  EXPECT_EQ(fired.load(), 0);
+}
+
+TEST(timer, when_all_within){
+  std::vector<Promise<int>> promises(3);
+  std::vector<Future<int>> futures;
+  for (auto &p : promises) {
+    futures.push_back(p.GetFuture());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto partial = WhenAllWithin(futures.begin(), futures.end(),
+                               std::chrono::milliseconds(30));
+  promises[0].SetValue(1);
+  promises[2].SetException(std::make_exception_ptr(std::runtime_error("x")));
+  auto results = partial.Get();
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(30));
+  ASSERT_EQ(results.size(), 3u);
+  ASSERT_TRUE(results[0].has_value());
+  EXPECT_EQ(results[0]->Value(), 1);
+  EXPECT_FALSE(results[1].has_value());
+  ASSERT_TRUE(results[2].has_value());
+  EXPECT_TRUE(results[2]->HasException());
+  // dropped
+  promises[1].SetValue(2);
+
+  // everything arrives early, the deadline does not delay the result
+  std::vector<Promise<int>> fast(2);
+  std::vector<Future<int>> fast_futures;
+  for (auto &p : fast) {
+    fast_futures.push_back(p.GetFuture());
+  }
+  start = std::chrono::steady_clock::now();
+  auto all = WhenAllWithin(fast_futures.begin(), fast_futures.end(),
+                           std::chrono::seconds(10));
+  fast[0].SetValue(1);
+  fast[1].SetValue(2);
+  auto fast_results = all.Get();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(fast_results[1]->Value(), 2);
+}
+
+TEST(retry, succeed_after_failures){
+  RetryPolicy policy;
+  policy.max_attempts = 5;
+  policy.initial_backoff = std::chrono::milliseconds(1);
+
+  auto attempts = std::make_shared<std::atomic<int>>(0);
+  auto future = Retry(policy, [attempts] {
+    if (++*attempts < 3) {
+      return MakeExceptFuture<int>(std::runtime_error("flaky"));
+    }
+    return MakeReadyFuture(42);
+  });
+
+  EXPECT_EQ(future.Get(), 42);
+  EXPECT_EQ(attempts->load(), 3);
+}
+
+TEST(retry, on_executor){
+  ExecutorAdaptor<boost::basic_thread_pool> pool(2);
+  CountingExecutor counting;
+  counting.pool = &pool;
+  RetryPolicy policy;
+  policy.initial_backoff = std::chrono::milliseconds(1);
+
+  auto attempts = std::make_shared<std::atomic<int>>(0);
+  auto future = Retry(&counting, policy, [attempts] {
+    if (++*attempts < 3) {
+      return MakeExceptFuture<int>(std::runtime_error("flaky"));
+    }
+    return MakeReadyFuture(42);
+  });
+
+  EXPECT_EQ(future.Get(), 42);
+  // the first attempt runs on the caller, the retries on the executor.
+  EXPECT_EQ(counting.submitted.load(), 2);
+}
+
+TEST(retry, give_up){
+  RetryPolicy policy;
+  policy.max_attempts = 3;
+  policy.initial_backoff = std::chrono::milliseconds(1);
+
+  auto attempts = std::make_shared<std::atomic<int>>(0);
+  auto future = Retry(policy, [attempts]() -> Future<void> {
+    ++*attempts;
+    throw std::runtime_error("down");
+  });
+  EXPECT_THROW(future.Get(), std::runtime_error);
+  EXPECT_EQ(attempts->load(), 3);
+
+  attempts->store(0);
+  policy.retry_if = [](std::exception_ptr e) {
+    try {
+      std::rethrow_exception(e);
+    } catch (std::logic_error &) {
+      return false;
+    } catch (...) {
+      return true;
+    }
+  };
+  auto filtered = Retry(policy, [attempts] {
+    ++*attempts;
+    return Async([]() -> int { throw std::logic_error("bad request"); });
+  });
+  EXPECT_THROW(filtered.Get(), std::logic_error);
+  EXPECT_EQ(attempts->load(), 1);
+}
+
+TEST(retry, backoff){
+  RetryPolicy policy;
+  policy.initial_backoff = std::chrono::milliseconds(10);
+  policy.max_backoff = std::chrono::milliseconds(50);
+  policy.jitter = 0;
+  EXPECT_EQ(policy.Backoff(1).count(), 10);
+  EXPECT_EQ(policy.Backoff(2).count(), 20);
+  EXPECT_EQ(policy.Backoff(3).count(), 40);
+  EXPECT_EQ(policy.Backoff(10).count(), 50);
+
+  policy.jitter = 0.5;
+  for (int i = 0; i < 100; i++) {
+    auto backoff = policy.Backoff(1).count();
+    EXPECT_GE(backoff, 5);
+    EXPECT_LE(backoff, 15);
+  }
+}
+
+TEST(hedge, duplicate_after_delay){
+  std::atomic<int> attempts{0};
+  std::vector<Promise<int>> promises(3);
+  auto future = Hedge(
+      [&] {
+        int i = attempts++;
+        return promises[i].GetFuture();
+      },
+      std::chrono::milliseconds(10), 3);
+  EXPECT_EQ(attempts, 1);
+
+  while (attempts < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  promises[1].SetValue(2);
+  EXPECT_EQ(future.Get(), 2);
+  // the winner disarmed the hedge timer, the loser is ignored.
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_EQ(attempts, 2);
+  promises[0].SetValue(1);
+
+  // a fast first attempt is never hedged.
+  attempts = 0;
+  auto fast = Hedge(
+      [&] {
+        attempts++;
+        return MakeReadyFuture(7);
+      },
+      std::chrono::milliseconds(5), 3);
+  EXPECT_EQ(fast.Get(), 7);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(attempts, 1);
+}
+
+TEST(hedge, failures){
+  std::atomic<int> attempts{0};
+  // a failure starts the next attempt without waiting for the delay.
+  auto future = Hedge(
+      [&]() -> Future<int> {
+        if (attempts++ < 2) {
+          return MakeExceptFuture<int>(std::runtime_error("busy"));
+        }
+        return MakeReadyFuture(3);
+      },
+      std::chrono::hours(1), 3);
+  EXPECT_EQ(future.Get(), 3);
+  EXPECT_EQ(attempts, 3);
+
+  auto failed = Hedge(
+      [] { return MakeExceptFuture<int>(std::runtime_error("down")); },
+      std::chrono::hours(1), 2);
+  EXPECT_THROW(failed.Get(), std::runtime_error);
+}
+
+TEST(hedge, adaptive_delay){
+  auto tracker = std::make_shared<LatencyTracker>(
+      0.9, std::chrono::milliseconds(50), 100);
+  EXPECT_EQ(tracker->Delay(), std::chrono::milliseconds(50));
+  for (int i = 1; i <= 100; i++) {
+    tracker->Record(std::chrono::milliseconds(i));
+  }
+  // recomputed every 16 records, the last time at record 95.
+  EXPECT_GE(tracker->Delay(), std::chrono::milliseconds(80));
+  EXPECT_LE(tracker->Delay(), std::chrono::milliseconds(90));
+
+  // the window forgets the old samples.
+  for (int i = 0; i < 100; i++) {
+    tracker->Record(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(tracker->Delay(), std::chrono::milliseconds(1));
+
+  std::atomic<int> attempts{0};
+  Promise<int> slow;
+  auto future = Hedge(
+      [&] {
+        return attempts++ == 0 ? slow.GetFuture() : MakeReadyFuture(2);
+      },
+      tracker, 2);
+  EXPECT_EQ(future.Get(), 2);
+  EXPECT_EQ(attempts, 2);
+  slow.SetValue(1);
+}
+
+TEST(hedge, on_executor){
+  ExecutorAdaptor<boost::basic_thread_pool> pool(2);
+  CountingExecutor counting;
+  counting.pool = &pool;
+
+  auto slow = std::make_shared<Promise<int>>();
+  auto attempts = std::make_shared<std::atomic<int>>(0);
+  auto future = Hedge(&counting,
+                      [slow, attempts] {
+                        if ((*attempts)++ == 0) {
+                          return slow->GetFuture();
+                        }
+                        return MakeReadyFuture(2);
+                      },
+                      std::chrono::milliseconds(5), 2);
+
+  EXPECT_EQ(future.Get(), 2);
+  // the first attempt runs on the caller, the hedge on the executor.
+  EXPECT_EQ(counting.submitted.load(), 1);
+  slow->SetValue(1);
+}
+
+TEST(channel, push_pop){
+  Channel<int> channel(2);
+  EXPECT_EQ(channel.Capacity(), size_t(2));
+
+  auto p1 = channel.Push(1);
+  auto p2 = channel.Push(2);
+  auto p3 = channel.Push(3);
+  EXPECT_NO_THROW(p1.Get());
+  EXPECT_NO_THROW(p2.Get());
+  EXPECT_EQ(p3.WaitFor(std::chrono::milliseconds(10)), FutureStatus::Timeout);
+
+  EXPECT_EQ(channel.Pop().Get(), 1);
+  auto p4 = channel.Push(4);
+  EXPECT_EQ(channel.Pop().Get(), 2);
+  EXPECT_EQ(channel.Pop().Get(), 3);
+  p4.Wait();
+  EXPECT_EQ(channel.Pop().Get(), 4);
+
+  auto pending = channel.Pop();
+  channel.Push(5);
+  EXPECT_EQ(pending.Get(), 5);
+
+  int value = 0;
+  EXPECT_FALSE(channel.TryPop(value));
+  value = 6;
+  EXPECT_TRUE(channel.TryPush(value));
+  EXPECT_TRUE(channel.TryPop(value));
+  EXPECT_EQ(value, 6);
+}
+
+TEST(channel, batch_and_close){
+  Channel<std::string> channel(8);
+  for (int i = 0; i < 5; i++) {
+    channel.Push(std::to_string(i));
+  }
+
+  auto batch = channel.PopBatch(3).Get();
+  EXPECT_EQ(batch.size(), size_t(3));
+  EXPECT_EQ(batch[0], "0");
+  batch = channel.PopBatch(10).Get();
+  EXPECT_EQ(batch.size(), size_t(2));
+
+  auto pending = channel.PopBatch(10);
+  channel.Push("x");
+  EXPECT_EQ(pending.Get().size(), size_t(1));
+
+  channel.Push("y");
+  auto waiting = channel.Pop();
+  EXPECT_EQ(waiting.Get(), "y");
+  auto blocked = channel.Pop();
+  channel.Push("z");
+  channel.Close();
+  EXPECT_EQ(blocked.Get(), "z");
+  EXPECT_THROW(channel.Push("w").Get(), std::runtime_error);
+  EXPECT_THROW(channel.Pop().Get(), std::runtime_error);
+
+  Channel<int> other(1);
+  EXPECT_EQ(other.Capacity(), size_t(2));
+  other.Push(0);
+  other.Push(1);
+  auto parked = other.Push(2);
+  other.Close();
+  EXPECT_THROW(parked.Get(), std::runtime_error);
+  EXPECT_EQ(other.Pop().Get(), 0);
+  EXPECT_EQ(other.Pop().Get(), 1);
+  EXPECT_THROW(other.Pop().Get(), std::runtime_error);
+}
+
+TEST(channel, mpmc){
+  Channel<int> channel(16);
+  const int producers = 4;
+  const int per_producer = 2000;
+  std::atomic<long> sum{0};
+  std::atomic<int> received{0};
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&channel, p] {
+      for (int i = 1; i <= per_producer; i++) {
+        channel.Push(p * per_producer + i).Wait();
+      }
+    });
+  }
+  for (int c = 0; c < 2; c++) {
+    threads.emplace_back([&] {
+      while (true) {
+        try {
+          sum += channel.Pop().Get();
+          received++;
+        } catch (std::exception &) {
+          return;
+        }
+      }
+    });
+  }
+
+  while (received != producers * per_producer) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  channel.Close();
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  long n = producers * per_producer;
+  EXPECT_EQ(sum.load(), n * (n + 1) / 2);
+}
+
+TEST(async_sync, semaphore_fifo){
+  AsyncSemaphore sem(2);
+  EXPECT_TRUE(sem.Acquire(2).Valid());
+  EXPECT_EQ(sem.Available(), 0u);
+
+  std::vector<int> order;
+  auto big = sem.Acquire(2).Then(Lauch::Sync, [&order] { order.push_back(2); });
+  auto small =
+      sem.Acquire(1).Then(Lauch::Sync, [&order] { order.push_back(1); });
+  // the head needs two permits, the small request waits behind it.
+  sem.Release(1);
+  EXPECT_TRUE(order.empty());
+  EXPECT_FALSE(sem.TryAcquire(1));
+
+  sem.Release(1);
+  EXPECT_EQ(order, std::vector<int>({2}));
+  sem.Release(2);
+  big.Get();
+  small.Get();
+  EXPECT_EQ(order, std::vector<int>({2, 1}));
+  EXPECT_EQ(sem.Available(), 1u);
+  EXPECT_TRUE(sem.TryAcquire(1));
+}
+
+TEST(async_sync, mutex_serializes_continuations){
+  AsyncMutex mutex;
+  {
+    auto guard = mutex.Lock().Get();
+    EXPECT_TRUE(guard.OwnsLock());
+    EXPECT_FALSE(mutex.TryLock().OwnsLock());
+    // dropping a pending Lock still hands the mutex back.
+    mutex.Lock();
+  }
+  EXPECT_TRUE(mutex.TryLock().OwnsLock());
+
+  ExecutorAdaptor<boost::basic_thread_pool> pool(4);
+  const int n = 200;
+  int counter = 0;
+  int inside = 0;
+  std::atomic<bool> overlapped{false};
+  std::vector<Future<void>> futures;
+  for (int i = 0; i < n; i++) {
+    futures.push_back(Async(&pool, [] {})
+                          .Then(Lauch::Sync, [&mutex] { return mutex.Lock(); })
+                          .Then(&pool, [&](AsyncMutex::Guard guard) {
+                            if (++inside != 1) {
+                              overlapped = true;
+                            }
+                            counter++;
+                            inside--;
+                            guard.Unlock();
+                          }));
+  }
+  for (auto &f : futures) {
+    f.Get();
+  }
+  EXPECT_EQ(counter, n);
+  EXPECT_FALSE(overlapped);
+  EXPECT_TRUE(mutex.TryLock().OwnsLock());
+}
+
+TEST(async_sync, mutex_released_when_callback_returns){
+  AsyncMutex mutex;
+  auto held = mutex.TryLock();
+  // the shared states keep their copies of the Guard, they do not own it.
+  auto locked = mutex.Lock();
+  auto done = locked.Then(Lauch::Sync, [&mutex](AsyncMutex::Guard guard) {
+    EXPECT_TRUE(guard.OwnsLock());
+    EXPECT_FALSE(mutex.TryLock().OwnsLock());
+  });
+  held.Unlock();
+  done.Get();
+  EXPECT_TRUE(mutex.TryLock().OwnsLock());
+
+  ExecutorAdaptor<boost::basic_thread_pool> pool(1);
+  auto ready = mutex.Lock();
+  ready
+      .Then(&pool,
+            [](AsyncMutex::Guard guard) { EXPECT_TRUE(guard.OwnsLock()); })
+      .Get();
+  EXPECT_TRUE(mutex.TryLock().OwnsLock());
+}
+
+TEST(async_sync, latch_and_barrier){
+  AsyncLatch latch(3);
+  auto waiting = latch.Wait();
+  latch.CountDown();
+  latch.CountDown();
+  EXPECT_FALSE(latch.TryWait());
+  EXPECT_EQ(waiting.WaitFor(std::chrono::milliseconds(0)),
+            FutureStatus::Timeout);
+  latch.CountDown();
+  EXPECT_TRUE(latch.TryWait());
+  EXPECT_TRUE(latch.Wait().Valid());
+
+  AsyncLatch open(0);
+  EXPECT_TRUE(open.TryWait());
+
+  AsyncBarrier barrier(3);
+  for (int phase = 0; phase < 2; phase++) {
+    std::atomic<int> released{0};
+    auto a = barrier.ArriveAndWait().Then(Lauch::Sync, [&] { released++; });
+    auto b = barrier.ArriveAndWait().Then(Lauch::Sync, [&] { released++; });
+    EXPECT_EQ(released, 0);
+    barrier.ArriveAndWait().Get();
+    a.Get();
+    b.Get();
+    EXPECT_EQ(released, 2);
+  }
+}
+
+TEST(async_cache, single_flight){
+  AsyncCache<std::string, int> cache(16);
+  int fetches = 0;
+  Promise<int> source;
+  auto fetch = [&](const std::string &) {
+    fetches++;
+    return source.GetFuture();
+  };
+
+  auto a = cache.Get("k", fetch);
+  auto b = cache.Get("k", fetch);
+  auto c = cache.Get("k", fetch);
+  EXPECT_EQ(fetches, 1);
+  int value = 0;
+  EXPECT_FALSE(cache.TryGet("k", value));
+
+  source.SetValue(7);
+  EXPECT_EQ(a.Get() + b.Get() + c.Get(), 21);
+  EXPECT_EQ(cache.Get("k", fetch).Get(), 7);
+  EXPECT_TRUE(cache.TryGet("k", value));
+  EXPECT_EQ(value, 7);
+  EXPECT_EQ(fetches, 1);
+
+  auto stats = cache.Stats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.coalesced, 2u);
+  EXPECT_EQ(stats.hits, 2u);
+
+  // failures reach every waiter and are not cached.
+  Promise<int> failing;
+  auto fail = [&](const std::string &) {
+    fetches++;
+    return failing.GetFuture();
+  };
+  auto d = cache.Get("bad", fail);
+  auto e = cache.Get("bad", fail);
+  failing.SetException(std::make_exception_ptr(std::runtime_error("down")));
+  EXPECT_THROW(d.Get(), std::runtime_error);
+  EXPECT_THROW(e.Get(), std::runtime_error);
+  EXPECT_EQ(cache.Get("bad", [&](const std::string &) {
+                   fetches++;
+                   return MakeReadyFuture(3);
+                 }).Get(), 3);
+  EXPECT_EQ(fetches, 3);
+
+  // a value put while fetching wins, the waiters still get the fetch.
+  Promise<int> slow;
+  auto f = cache.Get("p", [&](const std::string &) {
+    return slow.GetFuture();
+  });
+  cache.Put("p", 1);
+  slow.SetValue(2);
+  EXPECT_EQ(f.Get(), 2);
+  EXPECT_TRUE(cache.TryGet("p", value));
+  EXPECT_EQ(value, 1);
+}
+
+TEST(async_cache, lru_and_ttl){
+  AsyncCache<int, int> lru(2, AsyncCache<int, int>::Clock::duration::zero(),
+                           1);
+  auto fetch = [](int k) { return MakeReadyFuture(k * 10); };
+  EXPECT_EQ(lru.Get(1, fetch).Get(), 10);
+  EXPECT_EQ(lru.Get(2, fetch).Get(), 20);
+  int value = 0;
+  EXPECT_TRUE(lru.TryGet(1, value));
+  EXPECT_EQ(lru.Get(3, fetch).Get(), 30);
+  EXPECT_EQ(lru.Size(), 2u);
+  EXPECT_TRUE(lru.TryGet(1, value));
+  EXPECT_FALSE(lru.TryGet(2, value));
+  EXPECT_EQ(lru.Stats().evictions, 1u);
+
+  AsyncCache<int, int> ttl(16, std::chrono::milliseconds(20));
+  int fetches = 0;
+  auto counted = [&fetches](int k) {
+    fetches++;
+    return MakeReadyFuture(int(k));
+  };
+  ttl.Get(1, counted).Get();
+  ttl.Get(1, counted).Get();
+  EXPECT_EQ(fetches, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_FALSE(ttl.TryGet(1, value));
+  ttl.Get(1, counted).Get();
+  EXPECT_EQ(fetches, 2);
+}
+
+TEST(async_cache, concurrent_misses){
+  AsyncCache<int, int> cache(1024);
+  std::atomic<int> fetches{0};
+  ExecutorAdaptor<boost::basic_thread_pool> pool(2);
+  auto fetch = [&](int k) {
+    fetches++;
+    return Async(&pool, [k] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      return k;
+    });
+  };
+
+  std::vector<std::thread> threads;
+  std::atomic<int> sum{0};
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&] {
+      for (int k = 0; k < 8; k++) {
+        sum += cache.Get(k, fetch).Get();
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(sum, 4 * 28);
+  EXPECT_EQ(fetches, 8);
+}
+
+TEST(batcher, size_limit_and_per_key_errors){
+  std::vector<std::vector<int>> calls;
+  Batcher<int, std::string> batcher(
+      [&calls](const std::vector<int> &keys) {
+        calls.push_back(keys);
+        std::vector<Try<std::string>> out;
+        for (int k : keys) {
+          if (k < 0) {
+            out.emplace_back(
+                std::make_exception_ptr(std::runtime_error("negative")));
+          } else {
+            out.emplace_back(std::to_string(k));
+          }
+        }
+        return MakeReadyFuture(std::move(out));
+      },
+      3, std::chrono::hours(1));
+
+  auto a = batcher.Load(1);
+  auto b = batcher.Load(-2);
+  auto c = batcher.Load(1);
+  EXPECT_TRUE(calls.empty());
+  auto d = batcher.Load(3);
+  ASSERT_EQ(calls.size(), 1u);
+  EXPECT_EQ(calls[0], std::vector<int>({1, -2, 3}));
+  EXPECT_EQ(a.Get(), "1");
+  EXPECT_THROW(b.Get(), std::runtime_error);
+  EXPECT_EQ(c.Get(), "1");
+  EXPECT_EQ(d.Get(), "3");
+
+  auto e = batcher.Load(4);
+  batcher.Flush();
+  EXPECT_EQ(e.Get(), "4");
+  EXPECT_EQ(calls.size(), 2u);
+}
+
+TEST(batcher, window_and_failed_batch){
+  std::atomic<int> calls{0};
+  Promise<std::vector<Try<int>>> backend;
+  Batcher<int, int> batcher(
+      [&](const std::vector<int> &keys) {
+        calls++;
+        EXPECT_EQ(keys.size(), 2u);
+        return backend.GetFuture();
+      },
+      100, std::chrono::milliseconds(10));
+
+  auto a = batcher.Load(1);
+  auto b = batcher.Load(2);
+  while (calls == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  backend.SetException(std::make_exception_ptr(std::runtime_error("down")));
+  for (auto *f : {&a, &b}) {
+    try {
+      f->Get();
+      FAIL();
+    } catch (const std::runtime_error &e) {
+      EXPECT_STREQ(e.what(), "down");
+    }
+  }
+
+  // a result of the wrong size fails the whole batch.
+  Future<int> c;
+  {
+    Batcher<int, int> wrong(
+        [](const std::vector<int> &) {
+          return MakeReadyFuture(std::vector<Try<int>>());
+        },
+        100, std::chrono::hours(1));
+    c = wrong.Load(1);
+  }
+  EXPECT_THROW(c.Get(), std::runtime_error);
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(batcher, window_on_executor){
+  ExecutorAdaptor<boost::basic_thread_pool> pool(1);
+  CountingExecutor counting;
+  counting.pool = &pool;
+  Batcher<int, int> batcher(
+      &counting,
+      [](const std::vector<int> &keys) {
+        std::vector<Try<int>> values;
+        for (int key : keys) {
+          values.emplace_back(key * 2);
+        }
+        return MakeReadyFuture(std::move(values));
+      },
+      100, std::chrono::milliseconds(5));
+
+  // the expired window is issued on the executor, not on the timer thread.
+  EXPECT_EQ(batcher.Load(3).Get(), 6);
+  EXPECT_EQ(counting.submitted.load(), 1);
+}
+
+TEST(semi_future, lazy_until_via){
+  std::atomic<int> calls{0};
+  auto semi = Defer([&calls](int i){
+    calls++;
+    return i + 1;
+  }, 1).Then([](int i){
+    return i * 2;
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(calls.load(), 0);
+
+  boost::basic_thread_pool pool(2);
+  auto future = semi.Via(&pool);
+  EXPECT_FALSE(semi.Valid());
+  EXPECT_EQ(future.Get(), 4);
+  EXPECT_EQ(calls.load(), 1);
+}
+
+TEST(semi_future, get_inline){
+  auto id = std::this_thread::get_id();
+  auto semi = Defer([id]{
+    return id == std::this_thread::get_id();
+  }).Then([](Try<bool> t){
+    EXPECT_TRUE(t.Value());
+  });
+  semi.Get();
+
+  auto failed = Defer([]{
+    throw std::runtime_error("error");
+    return 1;
+  }).Then([](int i){
+    return i + 1;
+  });
+  EXPECT_THROW(failed.Get(), std::exception);
+}
+
+#ifdef __linux__
+TEST(reactor, pipe){
+  Reactor reactor;
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+
+  char buf[16] = {};
+  auto readable = reactor.WaitReadable(fds[0]);
+  auto read = reactor.ReadAsync(fds[0], buf, sizeof(buf));
+  EXPECT_EQ(readable.WaitFor(std::chrono::milliseconds(20)), FutureStatus::Timeout);
+
+  EXPECT_EQ(reactor.WriteAsync(fds[1], "hello", 5).Get(), size_t(5));
+  EXPECT_EQ(read.Get(), size_t(5));
+  EXPECT_EQ(std::string(buf, 5), "hello");
+
+  close(fds[1]);
+  EXPECT_EQ(reactor.ReadAsync(fds[0], buf, sizeof(buf)).Get(), size_t(0));
+
+  auto pending = reactor.ReadAsync(fds[0], buf, sizeof(buf));
+  reactor.Cancel(fds[0]);
+  close(fds[0]);
+}
+
+TEST(reactor, socketpair_backpressure){
+  Reactor reactor;
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  // fill the socket buffer, the next write parks until the peer reads.
+  std::vector<char> chunk(64 * 1024, 'x');
+  size_t written = 0;
+  while (true) {
+    ssize_t n = write(fds[0], chunk.data(), chunk.size());
+    if (n < 0) {
+      break;
+    }
+    written += n;
+  }
+
+  auto parked = reactor.WriteAsync(fds[0], "y", 1);
+  EXPECT_EQ(parked.WaitFor(std::chrono::milliseconds(20)), FutureStatus::Timeout);
+
+  std::vector<char> sink(chunk.size());
+  size_t drained = 0;
+  while (drained < written) {
+    size_t want = std::min(sink.size(), written - drained);
+    drained += reactor.ReadAsync(fds[1], sink.data(), want).Get();
+  }
+  reactor.WaitWritable(fds[0]).Get();
+  char c = 0;
+  EXPECT_EQ(reactor.ReadAsync(fds[1], &c, 1).Get(), size_t(1));
+  EXPECT_EQ(c, 'y');
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(reactor, accept){
+  Reactor reactor;
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  // abstract socket, nothing to clean up on disk.
+  std::string name = "purecpp_reactor_" + std::to_string(getpid());
+  memcpy(addr.sun_path + 1, name.data(), name.size());
+  socklen_t len = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+  ASSERT_EQ(bind(listener, (sockaddr *)&addr, len), 0);
+  ASSERT_EQ(listen(listener, 8), 0);
+
+  auto accepted = reactor.AcceptAsync(listener);
+  int client = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  ASSERT_EQ(connect(client, (sockaddr *)&addr, len), 0);
+
+  int server = accepted.Get();
+  EXPECT_GE(server, 0);
+  EXPECT_EQ(reactor.WriteAsync(client, "ping", 4).Get(), size_t(4));
+  char buf[4];
+  EXPECT_EQ(reactor.ReadAsync(server, buf, 4).Get(), size_t(4));
+  EXPECT_EQ(std::string(buf, 4), "ping");
+
+  close(server);
+  close(client);
+  close(listener);
+}
+
+TEST(reactor, regular_file){
+  Reactor reactor;
+  char path[] = "/tmp/purecpp_reactorXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  unlink(path);
+
+  EXPECT_EQ(reactor.WriteAsync(fd, "data", 4).Get(), size_t(4));
+  lseek(fd, 0, SEEK_SET);
+  char buf[8];
+  EXPECT_EQ(reactor.ReadAsync(fd, buf, sizeof(buf)).Get(), size_t(4));
+  EXPECT_EQ(std::string(buf, 4), "data");
+  close(fd);
+}
+
+// trivially copyable without a default constructor.
+struct ShmPoint {
+  ShmPoint(int x, double y) : x(x), y(y) {}
+  int x;
+  double y;
+};
+
+TEST(shm_future, fork_value_and_error){
+  std::string name = "/purecpp_shm_" + std::to_string(getpid());
+  auto future = SharedMemoryFuture<ShmPoint>::Create(name);
+  auto failed = SharedMemoryFuture<int>::Create(name + "_err");
+  EXPECT_FALSE(future.IsReady());
+  EXPECT_EQ(future.WaitFor(std::chrono::milliseconds(10)),
+            FutureStatus::Timeout);
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // the child maps the segments by name, like an unrelated process would.
+    auto promise = SharedMemoryPromise<ShmPoint>::Open(name, future.EventFd());
+    auto err = SharedMemoryPromise<int>::Open(name + "_err");
+    usleep(20000);
+    bool ok = promise.SetValue(ShmPoint{42, 2.5}) &&
+              !promise.SetValue(ShmPoint{0, 0}) && err.SetException("boom");
+    _exit(ok ? 0 : 1);
+  }
+
+  // blocks on the futex in the segment.
+  ShmPoint p = future.Get();
+  EXPECT_EQ(p.x, 42);
+  EXPECT_EQ(p.y, 2.5);
+  try {
+    failed.Get();
+    FAIL();
+  } catch (const std::runtime_error &e) {
+    EXPECT_STREQ(e.what(), "boom");
+  }
+
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+TEST(shm_future, reactor_then){
+  std::string name = "/purecpp_shm_then_" + std::to_string(getpid());
+  auto future = SharedMemoryFuture<int>::Create(name);
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    auto promise = SharedMemoryPromise<int>::Open(name, future.EventFd());
+    usleep(20000);
+    _exit(promise.SetValue(7) ? 0 : 1);
+  }
+
+  // the reactor thread is started after fork, the child only has this one.
+  Reactor reactor;
+  auto doubled =
+      future.ToFuture(reactor).Then(Lauch::Sync, [](int v) { return v * 2; });
+  EXPECT_EQ(doubled.Get(), 14);
+
+  // already set, resolves without the eventfd.
+  EXPECT_EQ(future.ToFuture(reactor).Get(), 7);
+
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+#endif
+
+TEST(asio, executor){
+  boost::asio::io_context ctx;
+  auto work = boost::asio::make_work_guard(ctx);
+  std::thread io([&ctx]{ ctx.run(); });
+
+  auto ex = MakeAsioExecutor(ctx);
+  auto strand = MakeAsioExecutor(boost::asio::make_strand(ctx));
+  auto io_id = Async(&ex, []{ return std::this_thread::get_id(); }).Get();
+  EXPECT_EQ(io_id, io.get_id());
+  auto f = Async(&strand, []{ return 1; }).Then(&strand, [](int i){ return i + 1; });
+  EXPECT_EQ(f.Get(), 2);
+
+  work.reset();
+  io.join();
+}
+
+TEST(asio, use_future){
+  boost::asio::io_context ctx;
+  auto work = boost::asio::make_work_guard(ctx);
+  std::thread io([&ctx]{ ctx.run(); });
+  auto ex = MakeAsioExecutor(ctx);
+
+  boost::asio::steady_timer timer(ctx, std::chrono::milliseconds(10));
+  Future<void> waited = timer.async_wait(purecpp::use_future);
+  waited.Get();
+
+  boost::asio::local::stream_protocol::socket a(ctx), b(ctx);
+  boost::asio::local::connect_pair(a, b);
+
+  char buf[5];
+  Future<size_t> read = boost::asio::async_read(b, boost::asio::buffer(buf), purecpp::use_future);
+  auto thread_id = read.Then(&ex, [](size_t n){
+    EXPECT_EQ(n, size_t(5));
+    return std::this_thread::get_id();
+  });
+  Future<size_t> written = boost::asio::async_write(a, boost::asio::buffer("hello", 5), purecpp::use_future);
+  EXPECT_EQ(written.Get(), size_t(5));
+  EXPECT_EQ(thread_id.Get(), io.get_id());
+  EXPECT_EQ(std::string(buf, 5), "hello");
+
+  b.close();
+  Future<size_t> failed = b.async_read_some(boost::asio::buffer(buf), purecpp::use_future);
+  EXPECT_THROW(failed.Get(), boost::system::system_error);
+
+  Future<void> posted = boost::asio::post(ctx, purecpp::use_future);
+  posted.Get();
+
+  work.reset();
+  io.join();
+}
+
+TEST(fiber_executor, get_suspends_fiber){
+  const int n = 2000;
+  std::vector<Promise<int>> promises(n);
+  std::vector<Future<int>> futures;
+  for (auto &p : promises) {
+    futures.push_back(p.GetFuture());
+  }
+
+  std::atomic<int> sum(0);
+  std::mutex mtx;
+  std::set<std::thread::id> ids;
+  {
+    FiberExecutor ex(2);
+    for (int i = 0; i < n; i++) {
+      ex.submit([&, i] {
+        sum += futures[i].Get();
+        std::unique_lock<std::mutex> lock(mtx);
+        ids.insert(std::this_thread::get_id());
+      });
+    }
+
+    while (ex.Live() != (size_t)n) {
+      std::this_thread::yield();
+    }
+    for (int i = 0; i < n; i++) {
+      promises[i].SetValue(i);
+    }
+  }
+  EXPECT_EQ(sum, n * (n - 1) / 2);
+  EXPECT_LE(ids.size(), 2u);
+}
+
+TEST(fiber_executor, blocked_task_does_not_starve){
+  // with one thread, the first task can only finish if its Get lets the
+  // second task run.
+  FiberExecutor ex(1);
+  Promise<int> promise;
+  auto future = promise.GetFuture();
+  auto result = Async(&ex, [&future] { return future.Get() + 1; });
+  Async(&ex, [&promise] { promise.SetValue(41); });
+  EXPECT_EQ(result.Get(), 42);
+}
+
+TEST(fiber_executor, wait_for_timeout){
+  FiberExecutor ex(1);
+  Promise<int> never;
+  auto future = never.GetFuture();
+  auto status = Async(&ex, [&future] {
+    return future.WaitFor(std::chrono::milliseconds(20));
+  });
+  auto other = Async(&ex, [] { return 1; });
+  EXPECT_EQ(other.Get(), 1);
+  EXPECT_EQ(status.Get(), FutureStatus::Timeout);
+
+  Promise<int> later;
+  auto late = later.GetFuture();
+  auto done = Async(&ex, [&late] {
+    auto status = late.WaitUntil(std::chrono::system_clock::now() +
+                                 std::chrono::seconds(5));
+    return status == FutureStatus::Done ? late.Get() : -1;
+  });
+  later.SetValue(7);
+  EXPECT_EQ(done.Get(), 7);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   auto result =  RUN_ALL_TESTS();
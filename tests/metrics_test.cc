@@ -0,0 +1,55 @@
+// The runtime metrics. FUTURE_ENABLE_METRICS changes the layout of
+// SharedState, so it has to be the same for everything linked together:
+// this file is its own target, built with the define, while future_test
+// covers the default build.
+#ifndef FUTURE_ENABLE_METRICS
+#error "metrics_test needs FUTURE_ENABLE_METRICS"
+#endif
+#include <gtest/gtest.h>
+#include <future/future.h>
+#include <future/metrics.h>
+
+using namespace purecpp;
+
+TEST(metrics, counters_and_histograms){
+  auto before = Metrics::Instance().Snapshot();
+  {
+    Promise<int> promise;
+    auto f = promise.GetFuture().Then([](int x){ return x + 1; });
+    auto g = f.Then(Lauch::Sync, [](int x){ return x + 1; });
+    promise.SetValue(1);
+    EXPECT_EQ(g.Get(), 3);
+
+    Promise<int> dropped;
+  }
+  auto after = Metrics::Instance().Snapshot();
+
+  auto delta = [&](Counter c){ return after.Get(c) - before.Get(c); };
+  EXPECT_GE(delta(Counter::FuturesCreated), 3u);
+  EXPECT_GE(delta(Counter::FuturesFulfilled), 2u);
+  EXPECT_GE(delta(Counter::FuturesAbandoned), 1u);
+  EXPECT_GE(delta(Counter::ContinuationsSubmitted), 1u);
+  EXPECT_GE(delta(Counter::ContinuationsInline), 1u);
+  EXPECT_GE(delta(Counter::LockAcquired), 1u);
+  EXPECT_GT(after.Get(Histogram::SubmitToRunNs).count,
+            before.Get(Histogram::SubmitToRunNs).count);
+  EXPECT_GT(after.Get(Histogram::FulfilToContinuationNs).count,
+            before.Get(Histogram::FulfilToContinuationNs).count);
+  EXPECT_GT(after.Get(Histogram::LockHoldNs).count,
+            before.Get(Histogram::LockHoldNs).count);
+
+  auto &h = after.Get(Histogram::SubmitToRunNs);
+  EXPECT_LE(h.p50, h.p99);
+  EXPECT_LE(h.p99, h.max);
+  EXPECT_NE(after.ToText().find("futures_created"), std::string::npos);
+  auto json = after.ToJson();
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_NE(json.find("\"submit_to_run_ns\":{\"count\":"), std::string::npos);
+  EXPECT_NE(json.find("\"lock_hold_ns\":{\"count\":"), std::string::npos);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  auto result =  RUN_ALL_TESTS();
+  return result;
+}
@@ -0,0 +1,404 @@
+// Stress and scalability harness for the Promise/Future races: SetValue
+// against Then, Wait and Get on the same state, fused Sync chains observed
+// while their source is fulfilled, and many fulfillers feeding one
+// WhenAllReduce, also with all of its inputs arriving at once. Every
+// scenario runs for 1, 2, 4, ... up to the number of cores and prints its
+// throughput per thread count, it exits non-zero when an invariant is
+// broken. On Linux it then compares pipe reads completed by a Reactor with
+// a thread per read. Build with -DENABLE_TSAN=ON to run it under ThreadSanitizer, the
+// default round count is lowered there.
+//
+//   future_stress [rounds] [max_threads]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <future/future.h>
+#ifdef __linux__
+#include <array>
+#include <fcntl.h>
+#include <future/reactor.h>
+#endif
+
+using namespace purecpp;
+
+#if defined(__SANITIZE_THREAD__)
+#define FUTURE_STRESS_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define FUTURE_STRESS_TSAN 1
+#endif
+#endif
+
+namespace {
+std::atomic<int> g_failures{0};
+
+#define STRESS_CHECK(cond)                                                     \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,    \
+                   #cond);                                                     \
+      g_failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+struct InlineExecutor {
+  void submit(std::function<void()> f) { f(); }
+};
+
+// xorshift, one per thread, seeded differently every run.
+class Random {
+public:
+  explicit Random(uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15ull | 1) {}
+
+  uint64_t Next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_;
+  }
+
+  // a random short busy wait to shift the interleaving.
+  void Jitter() {
+    for (uint64_t i = Next() % 64; i > 0; i--) {
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+  }
+
+private:
+  uint64_t state_;
+};
+
+// reusable sense reversing barrier.
+class SpinBarrier {
+public:
+  explicit SpinBarrier(size_t n) : n_(n), waiting_(0), phase_(0) {}
+
+  void Wait() {
+    size_t phase = phase_.load(std::memory_order_acquire);
+    if (waiting_.fetch_add(1, std::memory_order_acq_rel) + 1 == n_) {
+      waiting_.store(0, std::memory_order_relaxed);
+      phase_.store(phase + 1, std::memory_order_release);
+      return;
+    }
+    while (phase_.load(std::memory_order_acquire) == phase) {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  size_t n_;
+  std::atomic<size_t> waiting_;
+  std::atomic<size_t> phase_;
+};
+
+const size_t kBatch = 256;
+
+// runs setup on thread 0, then body(thread, rng) on every thread, then
+// verify on thread 0, rounds times; returns the seconds spent in body.
+template <typename Setup, typename Body, typename Verify>
+double RunRounds(size_t threads, size_t rounds, Setup setup, Body body,
+                 Verify verify) {
+  SpinBarrier barrier(threads);
+  std::atomic<int64_t> busy_ns{0};
+  uint64_t seed = (uint64_t)std::chrono::steady_clock::now()
+                      .time_since_epoch()
+                      .count();
+
+  auto worker = [&](size_t id) {
+    Random rng(seed + id);
+    for (size_t r = 0; r < rounds; r++) {
+      if (id == 0) {
+        setup(r);
+      }
+      barrier.Wait();
+      auto start = std::chrono::steady_clock::now();
+      body(id, r, rng);
+      barrier.Wait();
+      if (id == 0) {
+        busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        verify(r);
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; i++) {
+    pool.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &t : pool) {
+    t.join();
+  }
+  return busy_ns / 1e9;
+}
+
+// every object of a batch is fulfilled by one thread while the others call
+// Then, Wait and WaitFor on it, all at once. Get runs after the round since a
+// Then after Get is dropped.
+double SetThenGet(size_t threads, size_t rounds) {
+  struct Slot {
+    Promise<int> promise;
+    Future<int> future;
+    std::atomic<int> thens{0};
+    std::atomic<int> ran{0};
+  };
+  std::vector<std::unique_ptr<Slot>> slots(kBatch);
+  InlineExecutor inline_ex;
+
+  auto setup = [&](size_t) {
+    for (auto &slot : slots) {
+      slot.reset(new Slot);
+      slot->future = slot->promise.GetFuture();
+    }
+  };
+
+  auto body = [&](size_t id, size_t r, Random &rng) {
+    // every thread walks the batch in the same order, so the waiters
+    // can't wait on each other in a cycle.
+    for (size_t j = 0; j < kBatch; j++) {
+      auto &slot = *slots[j];
+      size_t setter = (j + r) % threads;
+      size_t getter = (j + r + 1) % threads;
+      rng.Jitter();
+      if (id == setter) {
+        slot.promise.SetValue((int)j);
+      }
+      if (id == getter) {
+        slot.future.Wait();
+      } else if (id != setter) {
+        if (rng.Next() % 4 == 0) {
+          STRESS_CHECK(slot.future.WaitFor(std::chrono::seconds(60)) ==
+                       FutureStatus::Done);
+        } else {
+          slot.thens++;
+          slot.future.Then(&inline_ex, [&slot](int v) {
+            STRESS_CHECK(v >= 0);
+            slot.ran++;
+          });
+        }
+      }
+    }
+  };
+
+  auto verify = [&](size_t) {
+    for (size_t j = 0; j < kBatch; j++) {
+      auto &slot = *slots[j];
+      STRESS_CHECK(slot.future.Get() == (int)j);
+      STRESS_CHECK(slot.ran == slot.thens);
+    }
+  };
+
+  return RunRounds(threads, rounds, setup, body, verify);
+}
+
+// a fused Sync chain is built and observed on one thread while another
+// thread fulfils its source.
+double FusedChain(size_t threads, size_t rounds) {
+  struct Slot {
+    Promise<int> promise;
+    Future<int> future;
+    int got = -1;
+  };
+  std::vector<std::unique_ptr<Slot>> slots(kBatch);
+
+  auto setup = [&](size_t) {
+    for (auto &slot : slots) {
+      slot.reset(new Slot);
+      slot->future = slot->promise.GetFuture();
+    }
+  };
+
+  auto body = [&](size_t id, size_t r, Random &rng) {
+    for (size_t j = 0; j < kBatch; j++) {
+      auto &slot = *slots[j];
+      size_t setter = (j + r) % threads;
+      size_t getter = (j + r + 1) % threads;
+      rng.Jitter();
+      if (id == setter) {
+        slot.promise.SetValue((int)j);
+      }
+      if (id == getter) {
+        auto f = slot.future.Then(Lauch::Sync, [](int v) { return v + 1; })
+                     .Then(Lauch::Sync, [](int v) { return v * 2; });
+        rng.Jitter();
+        slot.got = f.Get();
+      }
+    }
+  };
+
+  auto verify = [&](size_t) {
+    for (size_t j = 0; j < kBatch; j++) {
+      STRESS_CHECK(slots[j]->got == (int)(j + 1) * 2);
+    }
+  };
+
+  return RunRounds(threads, rounds, setup, body, verify);
+}
+
+// all threads fulfil disjoint promises of one WhenAllReduce.
+double Reduce(size_t threads, size_t rounds) {
+  std::vector<Promise<int>> promises;
+  Future<int64_t> sum;
+
+  auto setup = [&](size_t) {
+    promises = std::vector<Promise<int>>(kBatch);
+    std::vector<Future<int>> futures;
+    for (auto &p : promises) {
+      futures.push_back(p.GetFuture());
+    }
+    sum = WhenAllReduce(futures.begin(), futures.end(), int64_t(0),
+                        [](int64_t acc, int v) { return acc + v; });
+  };
+
+  auto body = [&](size_t id, size_t, Random &rng) {
+    for (size_t j = id; j < kBatch; j += threads) {
+      rng.Jitter();
+      promises[j].SetValue((int)j);
+    }
+  };
+
+  auto verify = [&](size_t) {
+    STRESS_CHECK(sum.Get() == int64_t(kBatch) * (kBatch - 1) / 2);
+  };
+
+  return RunRounds(threads, rounds, setup, body, verify);
+}
+
+// many small WhenAllReduce with one input per thread, all threads arrive at
+// the same one at once, so a folder letting go races with new arrivals. A
+// lost arrival leaves its sum pending, which the timed wait reports.
+double ReduceBurst(size_t threads, size_t rounds) {
+  std::vector<std::vector<Promise<int>>> promises(kBatch);
+  std::vector<Future<int64_t>> sums(kBatch);
+
+  auto setup = [&](size_t) {
+    for (size_t j = 0; j < kBatch; j++) {
+      promises[j] = std::vector<Promise<int>>(threads);
+      std::vector<Future<int>> futures;
+      for (auto &p : promises[j]) {
+        futures.push_back(p.GetFuture());
+      }
+      sums[j] = WhenAllReduce(futures.begin(), futures.end(), int64_t(0),
+                              [](int64_t acc, int v) { return acc + v; });
+    }
+  };
+
+  auto body = [&](size_t id, size_t, Random &) {
+    for (size_t j = 0; j < kBatch; j++) {
+      promises[j][id].SetValue((int)id + 1);
+    }
+  };
+
+  auto verify = [&](size_t) {
+    for (auto &sum : sums) {
+      bool ready =
+          sum.WaitFor(std::chrono::seconds(10)) == FutureStatus::Done;
+      STRESS_CHECK(ready);
+      if (ready) {
+        STRESS_CHECK(sum.Get() == int64_t(threads * (threads + 1) / 2));
+      }
+    }
+  };
+
+  return RunRounds(threads, rounds, setup, body, verify);
+}
+
+#ifdef __linux__
+// one read per pipe and round, every read is started before the pipes are
+// written; returns the reads per second.
+double PipeReads(size_t rounds,
+                 const std::function<Future<size_t>(int, char *)> &read_one) {
+  const int kPipes = 32;
+  std::vector<std::array<int, 2>> fds(kPipes);
+  for (auto &p : fds) {
+    STRESS_CHECK(pipe2(p.data(), O_NONBLOCK) == 0);
+  }
+
+  std::vector<char> bufs(kPipes);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < rounds; r++) {
+    std::vector<Future<size_t>> reads;
+    for (int i = 0; i < kPipes; i++) {
+      reads.push_back(read_one(fds[i][0], &bufs[i]));
+    }
+    for (int i = 0; i < kPipes; i++) {
+      STRESS_CHECK(write(fds[i][1], "x", 1) == 1);
+    }
+    for (auto &f : reads) {
+      STRESS_CHECK(f.Get() == 1);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  for (auto &p : fds) {
+    close(p[0]);
+    close(p[1]);
+  }
+  return kPipes * rounds / elapsed.count();
+}
+#endif
+}
+
+int main(int argc, char **argv) {
+#ifdef FUTURE_STRESS_TSAN
+  size_t rounds = 20;
+#else
+  size_t rounds = 200;
+#endif
+  size_t max_threads = std::max(2u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    rounds = std::strtoul(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    max_threads = std::strtoul(argv[2], nullptr, 10);
+  }
+
+  struct Scenario {
+    const char *name;
+    double (*run)(size_t threads, size_t rounds);
+  };
+  Scenario scenarios[] = {{"set_then_get", SetThenGet},
+                          {"fused_chain", FusedChain},
+                          {"when_all_reduce", Reduce},
+                          {"reduce_burst", ReduceBurst}};
+
+  std::printf("%-16s %8s %14s\n", "scenario", "threads", "futures/s");
+  for (auto &scenario : scenarios) {
+    for (size_t threads = 1;; threads *= 2) {
+      threads = std::min(threads, max_threads);
+      double seconds = scenario.run(threads, rounds);
+      std::printf("%-16s %8zu %14.0f\n", scenario.name, threads,
+                  seconds > 0 ? rounds * kBatch / seconds : 0.0);
+      std::fflush(stdout);
+      if (threads == max_threads) {
+        break;
+      }
+    }
+  }
+
+#ifdef __linux__
+  Reactor reactor;
+  double reactor_reads = PipeReads(rounds, [&reactor](int fd, char *buf) {
+    return reactor.ReadAsync(fd, buf, 1);
+  });
+  double thread_reads = PipeReads(rounds, [](int fd, char *buf) {
+    return Async([fd, buf]() -> size_t {
+      pollfd p{fd, POLLIN, 0};
+      poll(&p, 1, -1);
+      return read(fd, buf, 1);
+    });
+  });
+  std::printf("\n%-16s %14s\n", "pipe reads", "reads/s");
+  std::printf("%-16s %14.0f\n", "reactor", reactor_reads);
+  std::printf("%-16s %14.0f\n", "thread_per_read", thread_reads);
+#endif
+
+  if (g_failures) {
+    std::fprintf(stderr, "%d checks failed\n", g_failures.load());
+    return 1;
+  }
+  return 0;
+}